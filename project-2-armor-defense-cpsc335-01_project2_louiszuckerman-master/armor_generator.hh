@@ -0,0 +1,258 @@
+///////////////////////////////////////////////////////////////////////////////
+// armor_generator.hh
+//
+// Deterministic generator of synthetic armor catalogs, for running the
+// loaders and solvers in maxdefense.hh at sizes far beyond armor.csv.
+//
+// How to use:
+//
+//    ArmorGeneratorOptions options;
+//    options.rows = 1000000;
+//    options.seed = 42;
+//    options.correlation = 0.8;
+//    std::ofstream f("big_armor.csv");
+//    write_armor_csv(f, options);
+//
+// The same options give the same catalog wherever the same libm and
+// toolchain are used: the random numbers come from std::mt19937_64, whose
+// output is fixed by the standard, and are shaped by the transforms below
+// rather than by the implementation-defined std:: distributions. Those
+// transforms call std::log, std::exp, std::sin and friends, which are not
+// required to round identically everywhere, so another libm may move a
+// value by one in its last decimal.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "maxdefense.hh"
+
+// Shape of the generated cost or defense values.
+//	uniform:	between a and b
+//	normal:		mean a, standard deviation b
+//	lognormal:	exp of a normal with mean a and standard deviation b
+// Values below minimum are raised to minimum.
+struct ValueDistribution
+{
+	enum Kind
+	{
+		uniform,
+		normal,
+		lognormal
+	};
+
+	Kind kind;
+	double a;
+	double b;
+	double minimum;
+};
+
+// Everything that determines a generated catalog.
+struct ArmorGeneratorOptions
+{
+	uint64_t seed = 335;
+	size_t rows = 100000;
+
+	// The defaults resemble armor.csv: costs and defense of a few hundred.
+	ValueDistribution cost = {ValueDistribution::lognormal, 5.9, 0.6, 1};
+	ValueDistribution defense = {ValueDistribution::normal, 400, 150, 0};
+
+	// Correlation between cost and defense, from -1 to 1. Both are drawn from
+	// one pair of correlated standard normals (a Gaussian copula), so the
+	// setting works the same for every kind of distribution.
+	double correlation = 0.5;
+
+	// Values are rounded to this many decimal places; 0 gives whole gold
+	// pieces as project 4 expects.
+	int decimals = 2;
+};
+
+// Produces the rows of one synthetic catalog, one at a time.
+class ArmorGenerator
+{
+	//
+public:
+	//
+	explicit ArmorGenerator(const ArmorGeneratorOptions &options)
+		: _options(options),
+		  _engine(options.seed)
+	{
+		assert(options.correlation >= -1 && options.correlation <= 1);
+		assert(options.cost.minimum > 0);
+	}
+
+	// Generate the next row.
+	void next(std::string &description, double &cost, double &defense)
+	{
+		next_values(cost, defense);
+
+		static const char *const conditions[] = {
+			"new", "like-new", "used", "worn", "deteriorating", "brittle", "hardened"};
+		static const char *const qualities[] = {
+			"master-quality", "high-quality", "regular", "sub-par quality", "poor quality"};
+		static const char *const enchantments[] = {
+			"mystical", "magic", "enchanted", "divine", "lucky", "unlucky", "cursed"};
+		static const char *const races[] = {"human", "elf", "dwarf", "orc"};
+		static const char *const pieces[] = {
+			"shield", "chest plate", "helmet", "gloves", "gauntlets", "boots", "belt"};
+
+		description.clear();
+		description += pick(conditions);
+		description += ' ';
+		description += pick(qualities);
+		description += ' ';
+		description += pick(enchantments);
+		description += ' ';
+		description += pick(races);
+		description += ' ';
+		description += pick(pieces);
+	}
+
+	// Generate the next row without its description. The engine still
+	// steps past the words, so the values match the other overload's.
+	void next(double &cost, double &defense)
+	{
+		next_values(cost, defense);
+		_engine.discard(description_words);
+	}
+
+	//
+private:
+	// The number of words, and engine draws, in a description.
+	static constexpr unsigned description_words = 5;
+
+	void next_values(double &cost, double &defense)
+	{
+		double z_cost = standard_normal();
+		double z_other = standard_normal();
+		double rho = _options.correlation;
+		double z_defense = rho * z_cost + std::sqrt(1 - rho * rho) * z_other;
+
+		cost = shape(_options.cost, z_cost);
+		defense = shape(_options.defense, z_defense);
+	}
+
+	// Uniform double in (0, 1) from the top 53 bits of the engine.
+	double unit()
+	{
+		return ((_engine() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+	}
+
+	// Box-Muller; the second value of each pair is kept for the next call.
+	double standard_normal()
+	{
+		if (_has_spare)
+		{
+			_has_spare = false;
+			return _spare;
+		}
+		double radius = std::sqrt(-2 * std::log(unit()));
+		double angle = 2 * M_PI * unit();
+		_spare = radius * std::sin(angle);
+		_has_spare = true;
+		return radius * std::cos(angle);
+	}
+
+	// Map a standard normal onto distribution, then round and clamp.
+	double shape(const ValueDistribution &distribution, double z) const
+	{
+		double value = 0;
+		switch (distribution.kind)
+		{
+		case ValueDistribution::uniform:
+			value = distribution.a + (distribution.b - distribution.a) * 0.5 * std::erfc(-z / std::sqrt(2.0));
+			break;
+		case ValueDistribution::normal:
+			value = distribution.a + distribution.b * z;
+			break;
+		case ValueDistribution::lognormal:
+			value = std::exp(distribution.a + distribution.b * z);
+			break;
+		}
+
+		double scale = std::pow(10.0, _options.decimals);
+		value = std::round(value * scale) / scale;
+		return std::max(value, distribution.minimum);
+	}
+
+	template <size_t N>
+	const char *pick(const char *const (&words)[N])
+	{
+		return words[_engine() % N];
+	}
+
+	ArmorGeneratorOptions _options;
+	std::mt19937_64 _engine;
+	bool _has_spare = false;
+	double _spare = 0;
+};
+
+// Write a catalog in the '^'-delimited format of armor.csv, header included,
+// without holding it in memory.
+void write_armor_csv(std::ostream &out, const ArmorGeneratorOptions &options)
+{
+	ArmorGenerator generator(options);
+
+	out << "Item^Cost^Defense\n";
+
+	std::string description;
+	double cost, defense;
+	char line[256];
+	for (size_t row = 0; row < options.rows; row++)
+	{
+		generator.next(description, cost, defense);
+		std::snprintf(
+			line, sizeof(line), "%s^%.*f^%.*f\n",
+			description.c_str(), options.decimals, cost, options.decimals, defense);
+		out << line;
+	}
+}
+
+// Generate a catalog directly into memory, as load_armor_database would
+// have loaded it from the CSV.
+std::unique_ptr<ArmorVector> generate_armor_vector(const ArmorGeneratorOptions &options)
+{
+	ArmorGenerator generator(options);
+
+	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	result->reserve(options.rows);
+
+	std::string description;
+	double cost, defense;
+	for (size_t row = 0; row < options.rows; row++)
+	{
+		generator.next(description, cost, defense);
+		result->push_back(std::shared_ptr<ArmorItem>(new ArmorItem(description, cost, defense)));
+	}
+
+	return result;
+}
+
+// Generate only the cost and defense columns, in the flat form the solvers
+// use internally. No description is built, so this is the cheapest way to
+// get 10^8 rows into memory.
+void generate_armor_columns(
+	const ArmorGeneratorOptions &options,
+	std::vector<double> &costs,
+	std::vector<double> &defenses)
+{
+	ArmorGenerator generator(options);
+
+	costs.resize(options.rows);
+	defenses.resize(options.rows);
+
+	for (size_t row = 0; row < options.rows; row++)
+	{
+		generator.next(costs[row], defenses[row]);
+	}
+}
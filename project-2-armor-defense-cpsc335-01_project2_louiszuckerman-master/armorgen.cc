@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+// armorgen.cc
+//
+// Write a synthetic armor catalog in the format of armor.csv.
+//
+// Usage: armorgen [--rows N] [--seed S] [--cost KIND:A:B] [--defense KIND:A:B]
+//                 [--correlation R] [--decimals D] [--output path]
+// where KIND is uniform, normal or lognormal (see ValueDistribution).
+// Without --output the catalog goes to standard output.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "armor_generator.hh"
+
+
+// Parse KIND:A:B into distribution, keeping its minimum.
+bool parse_distribution(const std::string &text, ValueDistribution &distribution)
+{
+	std::stringstream ss(text);
+	std::string kind, a, b;
+	if (!std::getline(ss, kind, ':') || !std::getline(ss, a, ':') || !std::getline(ss, b))
+	{
+		return false;
+	}
+
+	if (kind == "uniform")
+	{
+		distribution.kind = ValueDistribution::uniform;
+	}
+	else if (kind == "normal")
+	{
+		distribution.kind = ValueDistribution::normal;
+	}
+	else if (kind == "lognormal")
+	{
+		distribution.kind = ValueDistribution::lognormal;
+	}
+	else
+	{
+		return false;
+	}
+
+	distribution.a = std::stod(a);
+	distribution.b = std::stod(b);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	ArmorGeneratorOptions options;
+	std::string output;
+
+	for (int i = 1; i < argc; i += 2)
+	{
+		std::string flag = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::cerr << "Missing value for " << flag << std::endl;
+			return 1;
+		}
+		std::string value = argv[i + 1];
+
+		bool ok = true;
+		if (flag == "--rows")
+		{
+			options.rows = std::stoull(value);
+		}
+		else if (flag == "--seed")
+		{
+			options.seed = std::stoull(value);
+		}
+		else if (flag == "--cost")
+		{
+			ok = parse_distribution(value, options.cost);
+		}
+		else if (flag == "--defense")
+		{
+			ok = parse_distribution(value, options.defense);
+		}
+		else if (flag == "--correlation")
+		{
+			options.correlation = std::stod(value);
+			ok = options.correlation >= -1 && options.correlation <= 1;
+		}
+		else if (flag == "--decimals")
+		{
+			options.decimals = std::stoi(value);
+			ok = options.decimals >= 0 && options.decimals <= 6;
+			if (options.decimals == 0)
+			{
+				options.cost.minimum = std::max(options.cost.minimum, 1.0);
+			}
+		}
+		else if (flag == "--output")
+		{
+			output = value;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if (!ok)
+		{
+			std::cerr << "Invalid option: " << flag << " " << value << std::endl;
+			return 1;
+		}
+	}
+
+	if (output.empty())
+	{
+		write_armor_csv(std::cout, options);
+		return std::cout ? 0 : 1;
+	}
+
+	std::ofstream f(output);
+	write_armor_csv(f, options);
+	if (!f)
+	{
+		std::cerr << "Failed to write " << output << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -8,17 +8,32 @@
 
 #pragma once
 
-//#include <algorithm>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <queue>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MAXDEFENSE_X86 1
+#endif
+
+#include "profile.hh"
+
 // One armor item available for purchase.
 class ArmorItem
 {
@@ -57,11 +72,54 @@ private:
 // Alias for a vector of shared pointers to ArmorItem objects.
 typedef std::vector<std::shared_ptr<ArmorItem>> ArmorVector;
 
+// Parse one row of the armor database, "description^cost^defense".
+// Returns false when the row is missing fields or has invalid values;
+// field_count tells the two apart. Shared by load_armor_database and the
+// streaming pipeline below.
+bool parse_armor_row(
+	const std::string &line,
+	std::string &description,
+	double &cost_gold,
+	double &defense_points,
+	size_t &field_count)
+{
+	std::vector<std::string> fields;
+	std::stringstream ss(line);
+
+	for (std::string field; std::getline(ss, field, '^');)
+	{
+		fields.push_back(field);
+	}
+
+	field_count = fields.size();
+	if (field_count != 3)
+	{
+		return false;
+	}
+
+	auto parse_dbl = [](const std::string &field, double &output) {
+		std::stringstream ss(field);
+		if (!ss)
+		{
+			return false;
+		}
+
+		ss >> output;
+
+		return true;
+	};
+
+	description = fields[0];
+	return parse_dbl(fields[1], cost_gold) && parse_dbl(fields[2], defense_points);
+}
+
 // Load all the valid armor items from the CSV database
 // Armor items that are missing fields, or have invalid values, are skipped.
 // Returns nullptr on I/O error.
 std::unique_ptr<ArmorVector> load_armor_database(const std::string &path)
 {
+	PROFILE_SCOPE("load_armor_database");
+
 	std::unique_ptr<ArmorVector> failure(nullptr);
 
 	std::ifstream f(path);
@@ -84,43 +142,20 @@ std::unique_ptr<ArmorVector> load_armor_database(const std::string &path)
 			continue;
 		}
 
-		std::vector<std::string> fields;
-		std::stringstream ss(line);
-
-		for (std::string field; std::getline(ss, field, '^');)
-		{
-			fields.push_back(field);
-		}
-
-		if (fields.size() != 3)
+		std::string description;
+		double cost_gold, defense_points;
+		size_t field_count;
+		if (!parse_armor_row(line, description, cost_gold, defense_points, field_count))
 		{
-			std::cout
-				<< "Failed to load armor database: Invalid field count at line " << line_number << "; Want 3 but got " << fields.size() << std::endl
-				<< "Line: " << line << std::endl;
-			return failure;
-		}
-
-		std::string
-			descr_field = fields[0],
-			cost_gold_field = fields[1],
-			defense_points_field = fields[2];
-
-		auto parse_dbl = [](const std::string &field, double &output) {
-			std::stringstream ss(field);
-			if (!ss)
+			if (field_count != 3)
 			{
-				return false;
+				std::cout
+					<< "Failed to load armor database: Invalid field count at line " << line_number << "; Want 3 but got " << field_count << std::endl
+					<< "Line: " << line << std::endl;
+				return failure;
 			}
-
-			ss >> output;
-
-			return true;
-		};
-
-		std::string description(descr_field);
-		double cost_gold, defense_points;
-		if (
-			parse_dbl(cost_gold_field, cost_gold) && parse_dbl(defense_points_field, defense_points))
+		}
+		else
 		{
 			result->push_back(
 				std::shared_ptr<ArmorItem>(
@@ -200,6 +235,8 @@ std::unique_ptr<ArmorVector> filter_armor_vector(
 	double max_defense,
 	int total_size)
 {
+	PROFILE_SCOPE("filter_armor_vector");
+
 	// TODO: implement this function, then delete the return statement below
 	std::unique_ptr<ArmorVector> filtered_vector(new ArmorVector);
 	size_t i = 0;
@@ -231,98 +268,2215 @@ std::unique_ptr<ArmorVector> filter_armor_vector(
 	return filtered_vector;
 }
 
-// Compute the optimal set of armor items with a greedy algorithm.
-// Specifically, among the armor items that fit within a total_cost gold budget,
-// choose the armors whose defense is greatest.
-// Repeat until no more armor items can be chosen, either because we've run out of armor items,
-// or run out of gold.
-std::unique_ptr<ArmorVector> greedy_max_defense(
+// Counters reported by prune_armor_vector: how many armor items came in,
+// why the removed ones were removed, and how many are left.
+struct PruneStats
+{
+	size_t input = 0;
+	size_t over_budget = 0;
+	size_t no_defense = 0;
+	size_t dominated = 0;
+	size_t output = 0;
+};
+
+// Create and return a new ArmorVector holding the armor items of source that
+// can matter to an optimal selection within total_cost, in their original
+// order. The optimal defense over the result is the same as over source, so
+// the result can be given to any of the solvers below instead of source.
+// An armor item is removed when:
+//	1) it costs more than total_cost, or
+//	2) its defense is zero or negative, or
+//	3) it is dominated beyond use: the armors that cost no more and defend at
+//	   least as much (ties broken by catalog order) are too expensive to all be
+//	   bought along with it. Any selection containing it then leaves out one
+//	   of them, which can be swapped in without losing defense.
+// Rule 3 is evaluated in O(n log n) by visiting armors from cheapest to most
+// expensive, keeping the cost of the armors seen so far in a Fenwick tree
+// indexed by defense rank. If stats is not null, the counters are stored there.
+std::unique_ptr<ArmorVector> prune_armor_vector(
+	const ArmorVector &source,
+	double total_cost,
+	PruneStats *stats = nullptr)
+{
+	PROFILE_SCOPE("prune_armor_vector");
+
+	PruneStats counters;
+	counters.input = source.size();
+
+	std::vector<size_t> candidates;
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		if (source[i]->cost() > total_cost)
+		{
+			counters.over_budget++;
+		}
+		else if (source[i]->defense() <= 0)
+		{
+			counters.no_defense++;
+		}
+		else
+		{
+			candidates.push_back(i);
+		}
+	}
+
+	// Cheapest first; among equal costs, strongest first; then catalog order.
+	// Every armor visited before another with at least its defense dominates it.
+	std::vector<size_t> order(candidates);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		if (source[a]->cost() != source[b]->cost())
+		{
+			return source[a]->cost() < source[b]->cost();
+		}
+		if (source[a]->defense() != source[b]->defense())
+		{
+			return source[a]->defense() > source[b]->defense();
+		}
+		return a < b;
+	});
+
+	// Rank 0 is the highest defense, so a prefix of ranks is "at least this defense".
+	std::vector<double> defense_levels;
+	for (size_t i : candidates)
+	{
+		defense_levels.push_back(source[i]->defense());
+	}
+	std::sort(defense_levels.begin(), defense_levels.end(), std::greater<double>());
+	defense_levels.erase(std::unique(defense_levels.begin(), defense_levels.end()), defense_levels.end());
+
+	std::vector<double> fenwick(defense_levels.size() + 1, 0);
+
+	// Sums are rounded, so only remove an armor when the budget is clearly exceeded.
+	const double slack = 1e-9 * std::max(1.0, std::fabs(total_cost));
+
+	std::vector<bool> keep(source.size(), false);
+	for (size_t i : order)
+	{
+		size_t rank = std::lower_bound(
+						  defense_levels.begin(), defense_levels.end(),
+						  source[i]->defense(), std::greater<double>()) -
+					  defense_levels.begin();
+
+		double dominator_cost = 0;
+		for (size_t k = rank + 1; k > 0; k -= k & (~k + 1))
+		{
+			dominator_cost += fenwick[k];
+		}
+
+		if (source[i]->cost() + dominator_cost > total_cost + slack)
+		{
+			counters.dominated++;
+		}
+		else
+		{
+			keep[i] = true;
+		}
+
+		for (size_t k = rank + 1; k < fenwick.size(); k += k & (~k + 1))
+		{
+			fenwick[k] += source[i]->cost();
+		}
+	}
+
+	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		if (keep[i])
+		{
+			result->push_back(source[i]);
+		}
+	}
+	counters.output = result->size();
+
+	if (stats)
+	{
+		*stats = counters;
+	}
+
+	return result;
+}
+
+// Compact result of a solver: the catalog indices of the chosen armor items,
+// in the order the solver returns them, along with their totals. The solvers
+// below build one of these instead of copying shared_ptrs into an ArmorVector
+// in their hot loops; materialize_selection gives the ArmorVector only when
+// the items themselves are needed.
+struct ArmorSelection
+{
+	std::vector<size_t> indices;
+	double total_cost = 0;
+	double total_defense = 0;
+};
+
+// Build the ArmorVector holding the armors of selection, in the same order.
+std::unique_ptr<ArmorVector> materialize_selection(
 	const ArmorVector &armors,
-	double total_cost)
+	const ArmorSelection &selection)
 {
-	// TODO: implement this function, then delete the return statement below
 	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	result->reserve(selection.indices.size());
+	for (size_t i : selection.indices)
+	{
+		result->push_back(armors[i]);
+	}
+	return result;
+}
+
+// Selection of the given catalog indices, which are sorted into catalog order.
+ArmorSelection selection_from_indices(
+	const ArmorVector &armors,
+	std::vector<size_t> indices)
+{
+	ArmorSelection selection;
+	std::sort(indices.begin(), indices.end());
+	for (size_t i : indices)
+	{
+		selection.total_cost += armors[i]->cost();
+		selection.total_defense += armors[i]->defense();
+	}
+	selection.indices = std::move(indices);
+	return selection;
+}
+
+// Selection of the armors whose bits are set in mask (bit j means armors[j]),
+// in catalog order, with totals already known to the caller.
+ArmorSelection selection_from_mask(
+	uint64_t mask,
+	double total_cost,
+	double total_defense)
+{
+	ArmorSelection selection;
+	for (size_t j = 0; mask != 0; j++, mask >>= 1)
+	{
+		if (mask & 1)
+		{
+			selection.indices.push_back(j);
+		}
+	}
+	selection.total_cost = total_cost;
+	selection.total_defense = total_defense;
+	return selection;
+}
+
+// Sums of a column of T. Integer columns add up in 64 bits so that no
+// subset of up to 63 items can overflow.
+template <typename T>
+struct ArmorSum
+{
+	typedef T type;
+};
+
+template <>
+struct ArmorSum<int32_t>
+{
+	typedef int64_t type;
+};
+
+// Costs and defenses of a catalog as flat columns of T, for the solver
+// kernels that are templated on the numeric type.
+//
+// ArmorTable<double> holds the values as they are. ArmorTable<int32_t> is
+// the fixed-point form: each value is a whole number of 1/scale units, so
+// with scale 100 costs are in centi-gold and defenses in centi-defense.
+// The database has two decimals, so that conversion is exact, and the
+// integer kernels then compare sums exactly, with no rounding drift, from
+// columns half the size of the double ones.
+template <typename T>
+struct ArmorTable
+{
+	std::vector<T> costs;
+	std::vector<T> defenses;
+	double scale = 1;
+
+	size_t size() const { return costs.size(); }
+
+	// A gold budget in the units of this table. Fixed-point budgets round
+	// down, since an item fits only if its whole cost does.
+	typename ArmorSum<T>::type budget(double total_cost) const
+	{
+		if constexpr (std::is_integral<T>::value)
+		{
+			return std::floor(total_cost * scale + 1e-6);
+		}
+		else
+		{
+			return total_cost * scale;
+		}
+	}
 
-	double result_cost = 0;
-	auto bestArmor = std::shared_ptr<ArmorItem>(new ArmorItem("test helmet", 1, 0));
-	double size = armors.size();
+	// A sum from this table, back in gold or defense points.
+	double unscale(typename ArmorSum<T>::type sum) const
+	{
+		return sum / scale;
+	}
+};
 
-	std::unique_ptr<ArmorVector> todo(new ArmorVector(armors));
+// Build the table of armors in units of 1/scale. Integer tables round each
+// value to the nearest unit, which must fit in T.
+template <typename T>
+ArmorTable<T> make_armor_table(const ArmorVector &armors, double scale = 1)
+{
+	auto convert = [&](double value) -> T {
+		if constexpr (std::is_integral<T>::value)
+		{
+			long long units = std::llround(value * scale);
+			assert(units >= std::numeric_limits<T>::min() && units <= std::numeric_limits<T>::max());
+			return T(units);
+		}
+		else
+		{
+			return T(value * scale);
+		}
+	};
 
-	while (!todo->empty())
+	ArmorTable<T> table;
+	table.scale = scale;
+	table.costs.reserve(armors.size());
+	table.defenses.reserve(armors.size());
+	for (auto &armor : armors)
 	{
-		double candidate, best = 0;
-		int index_best = 0;
+		table.costs.push_back(convert(armor->cost()));
+		table.defenses.push_back(convert(armor->defense()));
+	}
+	return table;
+}
+
+// The fixed-point table of armors, in hundredths by default.
+ArmorTable<int32_t> make_fixed_point_table(const ArmorVector &armors, double scale = 100)
+{
+	return make_armor_table<int32_t>(armors, scale);
+}
+
+// Return the indices of the armor items in the order the greedy algorithm
+// considers them: by decreasing defense/cost ratio, with ties kept in
+// catalog order. Armor with no defense never improves the total, so it is
+// left out. Fixed-point tables compare the ratios exactly by
+// cross-multiplying.
+template <typename T>
+std::vector<size_t> greedy_ratio_order(const ArmorTable<T> &table)
+{
+	typedef typename ArmorSum<T>::type S;
+	const size_t n = table.size();
 
-		for (int j = 0; j < todo->size(); j++)
+	std::vector<size_t> order;
+	order.reserve(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		if (table.defenses[i] > 0)
 		{
-			candidate = todo->at(j)->defense() / todo->at(j)->cost();
+			order.push_back(i);
+		}
+	}
 
-			if (candidate > best)
-			{
-				best = candidate;
-				bestArmor = todo->at(j);
-				index_best = j;
-			}
+	if constexpr (std::is_integral<T>::value)
+	{
+		// Compare d[a]/c[a] > d[b]/c[b] exactly, as d[a]*c[b] > d[b]*c[a].
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return S(table.defenses[a]) * table.costs[b] > S(table.defenses[b]) * table.costs[a];
+		});
+	}
+	else
+	{
+		std::vector<double> ratio(n);
+		for (size_t i : order)
+		{
+			ratio[i] = table.defenses[i] / table.costs[i];
 		}
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return ratio[a] > ratio[b];
+		});
+	}
+
+	return order;
+}
 
-		todo->erase(todo->begin() + index_best);
+std::vector<size_t> greedy_ratio_order(const ArmorVector &armors)
+{
+	return greedy_ratio_order(make_armor_table<double>(armors));
+}
+
+// Greedy on an ArmorTable; see greedy_max_defense_selection.
+template <typename T>
+ArmorSelection greedy_max_defense_table(
+	const ArmorTable<T> &table,
+	double total_cost)
+{
+	typedef typename ArmorSum<T>::type S;
+	const S budget = table.budget(total_cost);
+
+	const std::vector<size_t> order = greedy_ratio_order(table);
+
+	// cheapest_after[k] is the lowest cost among order[k..end).
+	std::vector<S> cheapest_after(order.size() + 1, std::numeric_limits<S>::max());
+	for (size_t k = order.size(); k > 0; k--)
+	{
+		cheapest_after[k - 1] = std::min(cheapest_after[k], S(table.costs[order[k - 1]]));
+	}
+
+	ArmorSelection selection;
+	S cost = 0, defense = 0;
+	for (size_t k = 0; k < order.size(); k++)
+	{
+		if (cost + cheapest_after[k] > budget)
+		{
+			break;
+		}
 
-		double temp_cost = bestArmor->cost();
-		if (temp_cost + result_cost <= total_cost)
+		if (table.costs[order[k]] + cost <= budget)
 		{
-			result->push_back(bestArmor);
-			result_cost += bestArmor->cost();
+			selection.indices.push_back(order[k]);
+			cost += table.costs[order[k]];
+			defense += table.defenses[order[k]];
 		}
 	}
 
-	return result;
+	selection.total_cost = table.unscale(cost);
+	selection.total_defense = table.unscale(defense);
+	return selection;
 }
 
-// Compute the optimal set of armor items with an exhaustive search algorithm.
-// Specifically, among all subsets of armor items,
-// return the subset whose gold cost fits within the total_cost budget,
-// and whose total defense is greatest.
-// To avoid overflow, the size of the armor items vector must be less than 64.
-std::unique_ptr<ArmorVector> exhaustive_max_defense(
+// Compute the optimal set of armor items with a greedy algorithm, as an ArmorSelection.
+// Specifically, among the armor items that fit within a total_cost gold budget,
+// choose the armors whose defense is greatest.
+// Repeat until no more armor items can be chosen, either because we've run out of armor items,
+// or run out of gold.
+//
+// Each defense/cost ratio is computed once and the candidates are sorted by
+// ratio (ties keep catalog order), so the whole selection is O(n log n).
+// The scan stops as soon as the remaining gold is below the cheapest armor
+// that is still left in the ordering.
+ArmorSelection greedy_max_defense_selection(
 	const ArmorVector &armors,
 	double total_cost)
 {
-	const int n = armors.size();
-	assert(n < 64);
+	PROFILE_SCOPE("greedy_max_defense");
 
-	// TODO: implement this function, then delete the return statement below
-	std::unique_ptr<ArmorVector> bestArmor_vec(new ArmorVector);
-	double candidate_cost, best_cost, candidate_defense, best_defense;
+	return greedy_max_defense_table(make_armor_table<double>(armors), total_cost);
+}
+
+// Compute the optimal set of armor items with a greedy algorithm.
+// The armors are returned in the order they were chosen; see
+// greedy_max_defense_selection.
+std::unique_ptr<ArmorVector> greedy_max_defense(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	return materialize_selection(armors, greedy_max_defense_selection(armors, total_cost));
+}
+
+// A run of consecutive positions [begin, end) in a GreedyIndex ordering.
+struct GreedyRange
+{
+	size_t begin;
+	size_t end;
+};
+
+// The greedy answer for one budget of a GreedyBatch. The selected armors are
+// the positions covered by ranges[first_range .. first_range + range_count)
+// of the batch.
+struct GreedyAnswer
+{
+	size_t first_range;
+	size_t range_count;
+	double total_cost;
+	double total_defense;
+};
+
+// Answers to a batch of budget queries, sharing one range buffer.
+struct GreedyBatch
+{
+	std::vector<GreedyRange> ranges;
+	std::vector<GreedyAnswer> answers;
+};
 
-	for (uint64_t i = 0; i <= (pow(2, n) - 1); i++)
+// Preprocessed form of greedy_max_defense for answering many budgets against
+// the same catalog.
+// The armors are kept in greedy ratio order along with prefix sums of their
+// cost and defense, and a min-cost segment tree that skips straight to the next
+// armor that still fits. A query walks the greedy selection one maximal run of
+// consecutive positions at a time; each run takes a binary search over the
+// prefix sums and a segment tree descent, so an answer made of k ranges costs
+// O((k + 1) log n), not O(log n + k), instead of a full O(n log n) greedy pass.
+// The index holds its own references to the armors, so it stays valid after
+// the ArmorVector it was built from is gone.
+// Totals come from prefix sums, so they may differ from greedy_max_defense in
+// the last bits of floating point rounding.
+class GreedyIndex
+{
+	//
+public:
+	//
+	explicit GreedyIndex(const ArmorVector &armors)
+		: _order(greedy_ratio_order(armors))
 	{
-		std::unique_ptr<ArmorVector> candidate_vec(new ArmorVector);
-		for (uint64_t j = 0; j <= n - 1; j++)
+		PROFILE_SCOPE("GreedyIndex build");
+
+		const size_t n = _order.size();
+
+		_items.reserve(n);
+		for (size_t k = 0; k < n; k++)
 		{
+			_items.push_back(armors[_order[k]]);
+		}
 
-			if (((i >> j) & 1) == 1)
-			{
-				//std::cout << "Bitwise if Loop Running" << std::endl;
-				candidate_vec->push_back(armors.at(j));
-			}
+		_prefix_cost.assign(n + 1, 0);
+		_prefix_defense.assign(n + 1, 0);
+		for (size_t k = 0; k < n; k++)
+		{
+			_prefix_cost[k + 1] = _prefix_cost[k] + armors[_order[k]]->cost();
+			_prefix_defense[k + 1] = _prefix_defense[k] + armors[_order[k]]->defense();
 		}
-		sum_armor_vector(*candidate_vec, candidate_cost, candidate_defense);
-		sum_armor_vector(*bestArmor_vec, best_cost, best_defense);
 
-		if (candidate_cost <= total_cost)
+		_leaves = 1;
+		while (_leaves < n)
 		{
-			if (bestArmor_vec->empty() || candidate_defense > best_defense)
-			{
-				bestArmor_vec->clear();
+			_leaves *= 2;
+		}
+		_min_cost.assign(2 * _leaves, INFINITY);
+		for (size_t k = 0; k < n; k++)
+		{
+			_min_cost[_leaves + k] = armors[_order[k]]->cost();
+		}
+		for (size_t node = _leaves - 1; node > 0; node--)
+		{
+			_min_cost[node] = std::min(_min_cost[2 * node], _min_cost[2 * node + 1]);
+		}
+	}
 
-				for (int k = 0; k < candidate_vec->size(); k++)
-				{
-					bestArmor_vec->push_back(candidate_vec->at(k));
-				}
+	//
+	size_t size() const { return _order.size(); }
+
+	// Catalog index of the armor at the given position of the greedy order.
+	size_t catalog_index(size_t position) const { return _order[position]; }
+
+	// Armor at the given position of the greedy order.
+	const std::shared_ptr<ArmorItem> &item(size_t position) const { return _items[position]; }
+
+	// Append the greedy selection for total_cost to ranges, and return its totals.
+	void query(
+		double total_cost,
+		std::vector<GreedyRange> &ranges,
+		double &result_cost,
+		double &result_defense) const
+	{
+		result_cost = result_defense = 0;
+
+		size_t position = first_fitting(0, result_cost, total_cost);
+		while (position < size())
+		{
+			// Everything up to end fits along with what was already chosen.
+			size_t end = std::upper_bound(
+							 _prefix_cost.begin() + position + 1,
+							 _prefix_cost.end(),
+							 total_cost - result_cost + _prefix_cost[position]) -
+						 _prefix_cost.begin() - 1;
+			end = std::max(end, position + 1);
+
+			ranges.push_back(GreedyRange{position, end});
+			result_cost += _prefix_cost[end] - _prefix_cost[position];
+			result_defense += _prefix_defense[end] - _prefix_defense[position];
+
+			position = first_fitting(end, result_cost, total_cost);
+		}
+	}
+
+	// Answer every budget in total_costs, in order.
+	GreedyBatch query_batch(const std::vector<double> &total_costs) const
+	{
+		PROFILE_SCOPE("GreedyIndex query_batch");
+
+		GreedyBatch batch;
+		batch.answers.reserve(total_costs.size());
+
+		for (double total_cost : total_costs)
+		{
+			GreedyAnswer answer;
+			answer.first_range = batch.ranges.size();
+			query(total_cost, batch.ranges, answer.total_cost, answer.total_defense);
+			answer.range_count = batch.ranges.size() - answer.first_range;
+			batch.answers.push_back(answer);
+		}
+
+		return batch;
+	}
+
+	// Build an ArmorVector holding the armors of one answer of a batch, for
+	// callers that need the items themselves.
+	std::unique_ptr<ArmorVector> materialize(const GreedyBatch &batch, size_t answer) const
+	{
+		std::unique_ptr<ArmorVector> result(new ArmorVector);
+
+		const GreedyAnswer &a = batch.answers.at(answer);
+		for (size_t r = a.first_range; r < a.first_range + a.range_count; r++)
+		{
+			for (size_t k = batch.ranges[r].begin; k < batch.ranges[r].end; k++)
+			{
+				result->push_back(item(k));
 			}
 		}
+
+		return result;
+	}
+
+	//
+private:
+	// First position at or after from whose armor fits next to spent gold, or
+	// size() when there is none.
+	size_t first_fitting(size_t from, double spent, double total_cost) const
+	{
+		if (from >= size())
+		{
+			return size();
+		}
+		return first_fitting(1, 0, _leaves, from, spent, total_cost);
 	}
 
-	return bestArmor_vec;
+	size_t first_fitting(
+		size_t node,
+		size_t node_begin,
+		size_t node_end,
+		size_t from,
+		double spent,
+		double total_cost) const
+	{
+		if (node_end <= from || _min_cost[node] + spent > total_cost)
+		{
+			return size();
+		}
+		if (node >= _leaves)
+		{
+			return node_begin;
+		}
+
+		size_t middle = (node_begin + node_end) / 2;
+		size_t found = first_fitting(2 * node, node_begin, middle, from, spent, total_cost);
+		if (found == size())
+		{
+			found = first_fitting(2 * node + 1, middle, node_end, from, spent, total_cost);
+		}
+		return found;
+	}
+
+	// The armors in greedy order.
+	ArmorVector _items;
+
+	// Catalog indices in greedy order.
+	std::vector<size_t> _order;
+
+	// _prefix_cost[k] is the total cost of the first k armors in greedy order; same for defense.
+	std::vector<double> _prefix_cost, _prefix_defense;
+
+	// Min-cost segment tree over the greedy order, with _leaves leaves.
+	size_t _leaves;
+	std::vector<double> _min_cost;
+};
+
+// Copy the cost and defense of each armor item into two flat arrays, so the
+// hot loops of the solvers do not go through shared_ptr.
+void split_armor_vector(
+	const ArmorVector &armors,
+	std::vector<double> &costs,
+	std::vector<double> &defenses)
+{
+	costs.resize(armors.size());
+	defenses.resize(armors.size());
+	for (size_t j = 0; j < armors.size(); j++)
+	{
+		costs[j] = armors[j]->cost();
+		defenses[j] = armors[j]->defense();
+	}
+}
+
+// Best subset found by an exhaustive scan, as a bitmask over the armor
+// items (bit j set means armors[j] is chosen) along with its totals.
+// found is false until some subset within the budget has been seen.
+// The totals are sums in S, which is double unless the scan ran over a
+// fixed-point table.
+template <typename S>
+struct BasicExhaustiveBest
+{
+	uint64_t mask = 0;
+	S cost = 0;
+	S defense = 0;
+	bool found = false;
+};
+
+typedef BasicExhaustiveBest<double> ExhaustiveBest;
+
+// True when a subset with the given defense and mask should replace best.
+// Ties go to the smaller mask, which is the subset a plain counting loop
+// over all masks would have kept, so every scan order agrees on the answer.
+template <typename S>
+bool exhaustive_better(S defense, uint64_t mask, const BasicExhaustiveBest<S> &best)
+{
+	return !best.found || defense > best.defense || (defense == best.defense && mask < best.mask);
+}
+
+// Keep the better of best and other.
+template <typename S>
+void exhaustive_merge(BasicExhaustiveBest<S> &best, const BasicExhaustiveBest<S> &other)
+{
+	if (other.found && exhaustive_better(other.defense, other.mask, best))
+	{
+		best = other;
+	}
+}
+
+// Scan the subsets gray(first) .. gray(last - 1), where gray(i) = i ^ (i >> 1)
+// is the binary reflected Gray code, and return the best one within total_cost.
+// Consecutive Gray codes differ in exactly one bit, so each step flips one
+// item and updates the running cost and defense in O(1). The sums are
+// recomputed from scratch every few thousand steps so floating point drift
+// cannot build up; integer sums are exact and never need it.
+//
+// With floating point sums, the running totals only screen candidates. A
+// subset whose running cost is within a small slack of the budget, or whose
+// running defense is within a small slack of the best, is summed again in
+// catalog order before it is compared, so ties and subsets that cost exactly
+// the budget are decided on the same sums as the plain counting loop.
+template <typename T>
+BasicExhaustiveBest<typename ArmorSum<T>::type> exhaustive_scan(
+	const std::vector<T> &costs,
+	const std::vector<T> &defenses,
+	typename ArmorSum<T>::type total_cost,
+	uint64_t first,
+	uint64_t last)
+{
+	PROFILE_SCOPE("exhaustive_scan");
+
+	typedef typename ArmorSum<T>::type S;
+	const size_t n = costs.size();
+	const uint64_t resync_period = std::is_floating_point<S>::value ? 4096 : 0;
+
+	BasicExhaustiveBest<S> best;
+
+	auto sum_mask = [&](uint64_t mask, S &cost, S &defense) {
+		cost = defense = 0;
+		for (size_t j = 0; j < n; j++)
+		{
+			if ((mask >> j) & 1)
+			{
+				cost += costs[j];
+				defense += defenses[j];
+			}
+		}
+	};
+
+	// Far more than the drift of resync_period running updates, far less
+	// than any real difference between two totals.
+	S cost_slack = 0, defense_slack = 0;
+	if (resync_period)
+	{
+		for (size_t j = 0; j < n; j++)
+		{
+			cost_slack += std::abs(costs[j]);
+			defense_slack += std::abs(defenses[j]);
+		}
+		cost_slack *= 1e-9;
+		defense_slack *= 1e-9;
+	}
+
+	S cost, defense;
+	uint64_t mask = first ^ (first >> 1);
+	sum_mask(mask, cost, defense);
+
+	for (uint64_t i = first; i < last; i++)
+	{
+		if (cost <= total_cost + cost_slack && (!best.found || defense >= best.defense - defense_slack))
+		{
+			S exact_cost = cost, exact_defense = defense;
+			if (resync_period)
+			{
+				sum_mask(mask, exact_cost, exact_defense);
+			}
+			if (exact_cost <= total_cost && exhaustive_better(exact_defense, mask, best))
+			{
+				best.mask = mask;
+				best.cost = exact_cost;
+				best.defense = exact_defense;
+				best.found = true;
+			}
+		}
+
+		if (i + 1 == last)
+		{
+			break;
+		}
+
+		uint64_t bit = __builtin_ctzll(i + 1);
+		mask ^= uint64_t(1) << bit;
+		if (resync_period && ((i + 1) % resync_period) == 0)
+		{
+			sum_mask(mask, cost, defense);
+		}
+		else if ((mask >> bit) & 1)
+		{
+			cost += costs[bit];
+			defense += defenses[bit];
+		}
+		else
+		{
+			cost -= costs[bit];
+			defense -= defenses[bit];
+		}
+	}
+
+	return best;
+}
+
+// Build the ArmorVector holding the armors selected by mask, in catalog order.
+std::unique_ptr<ArmorVector> armor_vector_from_mask(
+	const ArmorVector &armors,
+	uint64_t mask)
+{
+	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	for (size_t j = 0; j < armors.size(); j++)
+	{
+		if ((mask >> j) & 1)
+		{
+			result->push_back(armors[j]);
+		}
+	}
+	return result;
+}
+
+// Exhaustive search on an ArmorTable; see exhaustive_max_defense_selection.
+template <typename T>
+ArmorSelection exhaustive_max_defense_table(
+	const ArmorTable<T> &table,
+	double total_cost)
+{
+	const size_t n = table.size();
+	assert(n < 64);
+
+	auto best = exhaustive_scan(table.costs, table.defenses, table.budget(total_cost), 0, uint64_t(1) << n);
+
+	return selection_from_mask(best.mask, table.unscale(best.cost), table.unscale(best.defense));
+}
+
+// Compute the optimal set of armor items with an exhaustive search algorithm, as an ArmorSelection.
+// Specifically, among all subsets of armor items,
+// return the subset whose gold cost fits within the total_cost budget,
+// and whose total defense is greatest.
+// To avoid overflow, the size of the armor items vector must be less than 64.
+//
+// The subsets are visited in Gray code order (see exhaustive_scan), so each
+// one costs O(1) and nothing is allocated until the winner is built.
+ArmorSelection exhaustive_max_defense_selection(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	PROFILE_SCOPE("exhaustive_max_defense");
+
+	return exhaustive_max_defense_table(make_armor_table<double>(armors), total_cost);
+}
+
+// exhaustive_max_defense_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> exhaustive_max_defense(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	return materialize_selection(armors, exhaustive_max_defense_selection(armors, total_cost));
+}
+
+// Instruction sets for the batched exhaustive kernel, detected at run time.
+enum class SimdLevel
+{
+	Scalar,
+	AVX2,
+	AVX512
+};
+
+// The widest SimdLevel this machine supports.
+SimdLevel simd_level_supported()
+{
+#ifdef MAXDEFENSE_X86
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return SimdLevel::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return SimdLevel::AVX2;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+const char *simd_level_name(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX512:
+		return "avx512";
+	case SimdLevel::AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+// State of the batched exhaustive kernel. The first low_bits items are
+// spread across 2^low_bits lanes: lane l evaluates the subsets whose low
+// bits are l, that is the masks (high << low_bits) | l, so one step of
+// the kernel checks a whole vector of subsets against the budget at once.
+// The remaining items are walked by counting high upwards, so within a
+// lane a strictly greater defense is needed to replace the best, and ties
+// go to the smaller mask as in exhaustive_better.
+//
+// Lanes hold int32 fixed-point sums, which the caller has checked cannot
+// overflow. A lane with no subset in budget keeps best_defense INT32_MIN.
+struct ExhaustiveLanes
+{
+	unsigned low_bits = 0;
+	std::vector<int32_t> low_cost, low_defense;
+	std::vector<int32_t> high_cost, high_defense;
+	int32_t budget = 0;
+
+	std::vector<int32_t> best_defense;
+	std::vector<uint64_t> best_high;
+
+	ExhaustiveLanes(const ArmorTable<int32_t> &table, unsigned bits, int32_t total_cost)
+		: low_bits(bits),
+		  low_cost(size_t(1) << bits),
+		  low_defense(size_t(1) << bits),
+		  high_cost(table.costs.begin() + bits, table.costs.end()),
+		  high_defense(table.defenses.begin() + bits, table.defenses.end()),
+		  budget(total_cost),
+		  best_defense(size_t(1) << bits, INT32_MIN),
+		  best_high(size_t(1) << bits, 0)
+	{
+		for (size_t l = 0; l < low_cost.size(); l++)
+		{
+			for (unsigned j = 0; j < bits; j++)
+			{
+				if ((l >> j) & 1)
+				{
+					low_cost[l] += table.costs[j];
+					low_defense[l] += table.defenses[j];
+				}
+			}
+		}
+	}
+
+	size_t lanes() const { return low_cost.size(); }
+
+	// Number of high parts to walk, counting up from 0.
+	uint64_t high_count() const { return uint64_t(1) << high_cost.size(); }
+
+	// Update the sums of the high items from high - 1 to high. Counting up
+	// flips two bits per step on average, and integer sums need no resync.
+	void advance(uint64_t high, int32_t &cost, int32_t &defense) const
+	{
+		uint64_t flipped = high ^ (high - 1);
+		for (unsigned bit = 0; flipped; bit++, flipped >>= 1)
+		{
+			if ((high >> bit) & 1)
+			{
+				cost += high_cost[bit];
+				defense += high_defense[bit];
+			}
+			else
+			{
+				cost -= high_cost[bit];
+				defense -= high_defense[bit];
+			}
+		}
+	}
+
+	// Record a better subset for lane l.
+	void update(size_t l, uint64_t high, int32_t defense)
+	{
+		best_high[l] = high;
+		best_defense[l] = defense;
+	}
+
+	// The best subset over all lanes.
+	BasicExhaustiveBest<int64_t> merge() const
+	{
+		BasicExhaustiveBest<int64_t> best;
+		for (size_t l = 0; l < lanes(); l++)
+		{
+			uint64_t mask = (best_high[l] << low_bits) | l;
+			if (best_defense[l] != INT32_MIN && exhaustive_better<int64_t>(best_defense[l], mask, best))
+			{
+				best.mask = mask;
+				best.defense = best_defense[l];
+				best.found = true;
+			}
+		}
+		return best;
+	}
+};
+
+// Portable kernel; one subset per lane per step, in a loop the compiler
+// is free to vectorize.
+void exhaustive_lanes_scalar(ExhaustiveLanes &lanes)
+{
+	const size_t width = lanes.lanes();
+	int32_t high_cost = 0, high_defense = 0;
+	for (uint64_t high = 0; high < lanes.high_count(); high++)
+	{
+		if (high)
+		{
+			lanes.advance(high, high_cost, high_defense);
+		}
+		for (size_t l = 0; l < width; l++)
+		{
+			int32_t defense = lanes.low_defense[l] + high_defense;
+			if (lanes.low_cost[l] + high_cost <= lanes.budget && defense > lanes.best_defense[l])
+			{
+				lanes.update(l, high, defense);
+			}
+		}
+	}
+}
+
+#ifdef MAXDEFENSE_X86
+// 8 subsets per step in one AVX2 register. The lanes that improved are
+// found with movemask, which is almost always zero once a good subset is
+// known, so the scalar bookkeeping is rare.
+__attribute__((target("avx2"))) void exhaustive_lanes_avx2(ExhaustiveLanes &lanes)
+{
+	assert(lanes.lanes() == 8);
+	const __m256i low_cost = _mm256_loadu_si256((const __m256i *)lanes.low_cost.data());
+	const __m256i low_defense = _mm256_loadu_si256((const __m256i *)lanes.low_defense.data());
+	const __m256i budget = _mm256_set1_epi32(lanes.budget);
+	const __m256i none = _mm256_set1_epi32(INT32_MIN);
+	__m256i best = none;
+
+	int32_t high_cost = 0, high_defense = 0;
+	for (uint64_t high = 0; high < lanes.high_count(); high++)
+	{
+		if (high)
+		{
+			lanes.advance(high, high_cost, high_defense);
+		}
+		__m256i cost = _mm256_add_epi32(low_cost, _mm256_set1_epi32(high_cost));
+		__m256i defense = _mm256_add_epi32(low_defense, _mm256_set1_epi32(high_defense));
+		__m256i over = _mm256_cmpgt_epi32(cost, budget);
+		__m256i candidate = _mm256_blendv_epi8(defense, none, over);
+		__m256i better = _mm256_cmpgt_epi32(candidate, best);
+
+		int bits = _mm256_movemask_ps(_mm256_castsi256_ps(better));
+		if (bits)
+		{
+			best = _mm256_max_epi32(best, candidate);
+			alignas(32) int32_t values[8];
+			_mm256_store_si256((__m256i *)values, candidate);
+			for (; bits; bits &= bits - 1)
+			{
+				int l = __builtin_ctz(bits);
+				lanes.update(l, high, values[l]);
+			}
+		}
+	}
+}
+
+// 16 subsets per step in one AVX-512 register, with mask registers for
+// the budget test and the improved lanes.
+__attribute__((target("avx512f"))) void exhaustive_lanes_avx512(ExhaustiveLanes &lanes)
+{
+	assert(lanes.lanes() == 16);
+	const __m512i low_cost = _mm512_loadu_si512(lanes.low_cost.data());
+	const __m512i low_defense = _mm512_loadu_si512(lanes.low_defense.data());
+	const __m512i budget = _mm512_set1_epi32(lanes.budget);
+	const __m512i none = _mm512_set1_epi32(INT32_MIN);
+	__m512i best = none;
+
+	int32_t high_cost = 0, high_defense = 0;
+	for (uint64_t high = 0; high < lanes.high_count(); high++)
+	{
+		if (high)
+		{
+			lanes.advance(high, high_cost, high_defense);
+		}
+		__m512i cost = _mm512_add_epi32(low_cost, _mm512_set1_epi32(high_cost));
+		__m512i defense = _mm512_add_epi32(low_defense, _mm512_set1_epi32(high_defense));
+		__mmask16 fits = _mm512_cmple_epi32_mask(cost, budget);
+		__mmask16 better = _mm512_mask_cmpgt_epi32_mask(fits, defense, best);
+		if (better)
+		{
+			best = _mm512_mask_mov_epi32(best, better, defense);
+			alignas(64) int32_t values[16];
+			_mm512_store_si512(values, defense);
+			for (unsigned bits = better; bits; bits &= bits - 1)
+			{
+				int l = __builtin_ctz(bits);
+				lanes.update(l, high, values[l]);
+			}
+		}
+	}
+}
+#endif
+
+// Exhaustive search over a fixed-point table with the batched kernel for
+// level, or the widest one this machine has. The answer is the same as
+// exhaustive_scan over the whole table, ties included; tables that are too
+// small to fill the lanes, or whose sums could overflow int32, go to
+// exhaustive_scan directly.
+BasicExhaustiveBest<int64_t> exhaustive_scan_batched(
+	const ArmorTable<int32_t> &table,
+	int64_t total_cost,
+	SimdLevel level = simd_level_supported())
+{
+	PROFILE_SCOPE("exhaustive_scan_batched");
+
+	const size_t n = table.size();
+	assert(n < 64);
+
+	unsigned low_bits = level == SimdLevel::AVX512 ? 4 : 3;
+
+	int64_t cost_sum = 0, defense_sum = 0;
+	bool non_negative = true;
+	for (size_t j = 0; j < n; j++)
+	{
+		cost_sum += table.costs[j];
+		defense_sum += table.defenses[j];
+		non_negative = non_negative && table.costs[j] >= 0 && table.defenses[j] >= 0;
+	}
+
+	if (n < low_bits || !non_negative || cost_sum > INT32_MAX || defense_sum >= INT32_MAX)
+	{
+		return exhaustive_scan(table.costs, table.defenses, total_cost, 0, uint64_t(1) << n);
+	}
+
+	// Every sum is in [0, cost_sum], so clamping the budget to [-1, cost_sum]
+	// changes no comparison.
+	int32_t budget = std::max<int64_t>(-1, std::min(total_cost, cost_sum));
+	ExhaustiveLanes lanes(table, low_bits, budget);
+
+	switch (level)
+	{
+#ifdef MAXDEFENSE_X86
+	case SimdLevel::AVX512:
+		exhaustive_lanes_avx512(lanes);
+		break;
+	case SimdLevel::AVX2:
+		exhaustive_lanes_avx2(lanes);
+		break;
+#endif
+	default:
+		exhaustive_lanes_scalar(lanes);
+		break;
+	}
+
+	BasicExhaustiveBest<int64_t> best = lanes.merge();
+	if (best.found)
+	{
+		for (size_t j = 0; j < n; j++)
+		{
+			if ((best.mask >> j) & 1)
+			{
+				best.cost += table.costs[j];
+			}
+		}
+	}
+	return best;
+}
+
+// Exhaustive search with the batched kernel, as a drop-in for
+// exhaustive_max_defense_selection. It runs on the fixed-point table, so
+// the comparisons are exact; on this two-decimal database that is the
+// subset the double scan finds too, short of sums that round differently.
+ArmorSelection exhaustive_max_defense_simd_selection(
+	const ArmorVector &armors,
+	double total_cost,
+	SimdLevel level = simd_level_supported())
+{
+	PROFILE_SCOPE("exhaustive_max_defense_simd");
+
+	ArmorTable<int32_t> table = make_fixed_point_table(armors);
+	BasicExhaustiveBest<int64_t> best = exhaustive_scan_batched(table, table.budget(total_cost), level);
+	return selection_from_mask(best.mask, table.unscale(best.cost), table.unscale(best.defense));
+}
+
+// exhaustive_max_defense_simd_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> exhaustive_max_defense_simd(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	return materialize_selection(armors, exhaustive_max_defense_simd_selection(armors, total_cost));
+}
+
+// Same as exhaustive_max_defense, but the 2^n masks are split into chunks
+// that thread_count threads claim from a shared counter. Each thread keeps
+// its own best subset and the per-thread results are merged at the end;
+// since ties go to the smaller mask, the answer is the same as the
+// sequential version no matter how the chunks were scheduled.
+ArmorSelection exhaustive_max_defense_parallel_selection(
+	const ArmorVector &armors,
+	double total_cost,
+	unsigned thread_count = std::thread::hardware_concurrency())
+{
+	PROFILE_SCOPE("exhaustive_max_defense_parallel");
+
+	const int n = armors.size();
+	assert(n < 64);
+
+	if (thread_count == 0)
+	{
+		thread_count = 1;
+	}
+
+	std::vector<double> costs, defenses;
+	split_armor_vector(armors, costs, defenses);
+
+	// Several chunks per thread to even out the load, but not so small that
+	// the Gray code setup of a chunk shows up. The chunk is a power of two no
+	// smaller than the scan's resync period, so every chunk starts on a
+	// resync point and sees bit-for-bit the running sums of the sequential
+	// scan.
+	const uint64_t total = uint64_t(1) << n;
+	const uint64_t min_chunk = uint64_t(1) << 14;
+	const uint64_t target = total / (uint64_t(thread_count) * 16);
+	uint64_t chunk = min_chunk;
+	while (chunk * 2 <= target)
+	{
+		chunk *= 2;
+	}
+	const uint64_t chunk_count = (total + chunk - 1) / chunk;
+
+	std::atomic<uint64_t> next_chunk(0);
+	std::vector<ExhaustiveBest> thread_best(thread_count);
+
+	auto work = [&](unsigned t) {
+		for (uint64_t c = next_chunk++; c < chunk_count; c = next_chunk++)
+		{
+			uint64_t first = c * chunk;
+			uint64_t last = std::min(total, first + chunk);
+			exhaustive_merge(thread_best[t], exhaustive_scan(costs, defenses, total_cost, first, last));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < thread_count; t++)
+	{
+		threads.emplace_back(work, t);
+	}
+	work(0);
+	for (auto &thread : threads)
+	{
+		thread.join();
+	}
+
+	ExhaustiveBest best;
+	for (auto &other : thread_best)
+	{
+		exhaustive_merge(best, other);
+	}
+
+	return selection_from_mask(best.mask, best.cost, best.defense);
+}
+
+// exhaustive_max_defense_parallel_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> exhaustive_max_defense_parallel(
+	const ArmorVector &armors,
+	double total_cost,
+	unsigned thread_count = std::thread::hardware_concurrency())
+{
+	return materialize_selection(armors, exhaustive_max_defense_parallel_selection(armors, total_cost, thread_count));
+}
+
+// Compute the optimal set of armor items with the meet-in-the-middle
+// algorithm of Horowitz and Sahni.
+// The armors are split into two halves and the cost and defense of every
+// subset of each half are enumerated. The second half's subsets are sorted by
+// cost and thinned to the ones that are not dominated (a cheaper or equally
+// cheap subset with at least as much defense), which leaves defense strictly
+// increasing with cost. Each first-half subset is then paired with the best
+// second-half subset it can afford, found by binary search.
+// This takes O(2^(n/2) n) time and O(2^(n/2)) memory, which makes exact
+// answers practical up to n of about 50. The size of the armor items vector
+// must be less than 64.
+ArmorSelection mitm_max_defense_selection(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	PROFILE_SCOPE("mitm_max_defense");
+
+	const int n = armors.size();
+	assert(n < 64);
+
+	struct HalfSubset
+	{
+		double cost;
+		double defense;
+		uint32_t mask;
+	};
+
+	// All subsets of armors[first .. first + count), with their totals.
+	auto enumerate_half = [&](int first, int count) {
+		PROFILE_SCOPE("enumerate half");
+
+		std::vector<HalfSubset> subsets(size_t(1) << count);
+		subsets[0] = HalfSubset{0, 0, 0};
+		for (int j = 0; j < count; j++)
+		{
+			const double cost = armors[first + j]->cost();
+			const double defense = armors[first + j]->defense();
+			const uint32_t bit = uint32_t(1) << j;
+			for (uint32_t m = 0; m < bit; m++)
+			{
+				subsets[m | bit] = HalfSubset{subsets[m].cost + cost, subsets[m].defense + defense, m | bit};
+			}
+		}
+		return subsets;
+	};
+
+	const int low_count = n / 2;
+	const int high_count = n - low_count;
+
+	std::vector<HalfSubset> high = enumerate_half(low_count, high_count);
+	std::sort(high.begin(), high.end(), [](const HalfSubset &a, const HalfSubset &b) {
+		if (a.cost != b.cost)
+		{
+			return a.cost < b.cost;
+		}
+		if (a.defense != b.defense)
+		{
+			return a.defense > b.defense;
+		}
+		return a.mask < b.mask;
+	});
+
+	// Keep only the subsets that beat every cheaper one.
+	size_t kept = 0;
+	for (size_t k = 0; k < high.size(); k++)
+	{
+		if (kept == 0 || high[k].defense > high[kept - 1].defense)
+		{
+			high[kept++] = high[k];
+		}
+	}
+	high.resize(kept);
+	high.shrink_to_fit();
+
+	std::vector<HalfSubset> low = enumerate_half(0, low_count);
+
+	ExhaustiveBest best;
+	for (const HalfSubset &a : low)
+	{
+		if (a.cost > total_cost)
+		{
+			continue;
+		}
+
+		auto it = std::upper_bound(
+			high.begin(), high.end(), total_cost - a.cost,
+			[](double remaining, const HalfSubset &b) { return remaining < b.cost; });
+
+		// The subtraction above can round differently from the sum checked by
+		// the other solvers, so settle the boundary with the sum itself.
+		while (it != high.begin() && a.cost + (it - 1)->cost > total_cost)
+		{
+			--it;
+		}
+		if (it == high.begin())
+		{
+			continue;
+		}
+		--it;
+
+		const double defense = a.defense + it->defense;
+		const uint64_t mask = uint64_t(a.mask) | (uint64_t(it->mask) << low_count);
+		if (exhaustive_better(defense, mask, best))
+		{
+			best.mask = mask;
+			best.cost = a.cost + it->cost;
+			best.defense = defense;
+			best.found = true;
+		}
+	}
+
+	return selection_from_mask(best.mask, best.cost, best.defense);
+}
+
+// mitm_max_defense_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> mitm_max_defense(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	return materialize_selection(armors, mitm_max_defense_selection(armors, total_cost));
+}
+
+// Counters reported by the search-based solvers.
+// nodes_explored counts the search nodes that were expanded, and
+// nodes_pruned counts the ones discarded because they could not beat the
+// best selection found so far.
+struct SearchStats
+{
+	size_t nodes_explored = 0;
+	size_t nodes_pruned = 0;
+};
+
+// Pool of search nodes. Nodes are allocated in fixed-size blocks, addressed
+// by index, and recycled through a free list, so a search does not make one
+// heap allocation per node and indices stay valid as the pool grows.
+template <typename T>
+class NodePool
+{
+	//
+public:
+	//
+	size_t allocate()
+	{
+		if (!_free.empty())
+		{
+			size_t index = _free.back();
+			_free.pop_back();
+			return index;
+		}
+		if (_size == _blocks.size() * block_size)
+		{
+			_blocks.emplace_back(new T[block_size]);
+		}
+		return _size++;
+	}
+
+	void release(size_t index) { _free.push_back(index); }
+
+	T &operator[](size_t index) { return _blocks[index / block_size][index % block_size]; }
+
+	// Number of nodes in use.
+	size_t live() const { return _size - _free.size(); }
+
+	//
+private:
+	static const size_t block_size = 4096;
+
+	std::vector<std::unique_ptr<T[]>> _blocks;
+	std::vector<size_t> _free;
+	size_t _size = 0;
+};
+
+// Compute the optimal set of armor items with best-first branch and bound.
+// The affordable armors with positive defense are sorted by defense/cost
+// ratio. A node of the search tree has decided whether to take each of the
+// first level armors in that order, and is bounded by the fractional
+// knapsack relaxation of the rest: the following armors are added whole
+// while they fit and the next one is added fractionally, which prefix sums
+// and a binary search give in O(log n). The node with the highest bound is
+// expanded first, starting from the greedy selection as the incumbent, and
+// any node whose bound cannot beat the incumbent is pruned.
+// Costs may be any positive real number, and catalogs of thousands of
+// armors are usually solved exactly in a fraction of a second. If stats is
+// not null, the node counters are stored there.
+ArmorSelection branch_and_bound_max_defense_selection(
+	const ArmorVector &armors,
+	double total_cost,
+	SearchStats *stats = nullptr)
+{
+	PROFILE_SCOPE("branch_and_bound_max_defense");
+
+	SearchStats counters;
+
+	std::vector<size_t> order;
+	for (size_t i : greedy_ratio_order(armors))
+	{
+		if (armors[i]->cost() <= total_cost)
+		{
+			order.push_back(i);
+		}
+	}
+	const size_t m = order.size();
+
+	std::vector<double> costs(m), defenses(m), prefix_cost(m + 1, 0), prefix_defense(m + 1, 0);
+	for (size_t k = 0; k < m; k++)
+	{
+		costs[k] = armors[order[k]]->cost();
+		defenses[k] = armors[order[k]]->defense();
+		prefix_cost[k + 1] = prefix_cost[k] + costs[k];
+		prefix_defense[k + 1] = prefix_defense[k] + defenses[k];
+	}
+
+	// Fractional knapsack bound for armors level.. with spent gold and defense so far.
+	auto upper_bound = [&](size_t level, double spent, double defense) {
+		size_t end = std::upper_bound(
+						 prefix_cost.begin() + level,
+						 prefix_cost.end(),
+						 total_cost - spent + prefix_cost[level]) -
+					 prefix_cost.begin() - 1;
+		double bound = defense + prefix_defense[end] - prefix_defense[level];
+		if (end < m)
+		{
+			double left = total_cost - spent - (prefix_cost[end] - prefix_cost[level]);
+			bound += std::max(0.0, left) * defenses[end] / costs[end];
+		}
+		return bound;
+	};
+
+	// Each node points at its parent, so a selection is recovered by walking
+	// up the tree. A node stays in the pool while it is queued or being
+	// expanded, or while any of its children are alive.
+	struct Node
+	{
+		double cost;
+		double defense;
+		double bound;
+		size_t level;
+		size_t parent;
+		size_t children;
+		bool taken;
+		bool queued;
+	};
+	const size_t no_parent = SIZE_MAX;
+	NodePool<Node> pool;
+
+	auto release = [&](size_t index) {
+		while (index != no_parent && pool[index].children == 0 && !pool[index].queued)
+		{
+			size_t parent = pool[index].parent;
+			pool.release(index);
+			if (parent != no_parent)
+			{
+				pool[parent].children--;
+			}
+			index = parent;
+		}
+	};
+
+	// Incumbent: chosen[k] says whether order[k] is taken.
+	std::vector<bool> chosen(m, false);
+	double best_defense = 0;
+
+	// The greedy selection is a good first incumbent.
+	{
+		double spent = 0;
+		for (size_t k = 0; k < m; k++)
+		{
+			if (spent + costs[k] <= total_cost)
+			{
+				chosen[k] = true;
+				spent += costs[k];
+				best_defense += defenses[k];
+			}
+		}
+	}
+
+	auto record_incumbent = [&](size_t index) {
+		std::fill(chosen.begin(), chosen.end(), false);
+		best_defense = pool[index].defense;
+		for (; index != no_parent; index = pool[index].parent)
+		{
+			if (pool[index].taken)
+			{
+				chosen[pool[index].level - 1] = true;
+			}
+		}
+	};
+
+	typedef std::pair<double, size_t> QueueEntry;
+	std::priority_queue<QueueEntry> queue;
+
+	auto add_child = [&](size_t parent, bool taken, double cost, double defense, double bound) {
+		size_t index = pool.allocate();
+		pool[index] = Node{cost, defense, bound, pool[parent].level + 1, parent, 0, taken, false};
+		pool[parent].children++;
+
+		if (defense > best_defense)
+		{
+			record_incumbent(index);
+		}
+
+		if (pool[index].level < m && bound > best_defense)
+		{
+			pool[index].queued = true;
+			queue.push(QueueEntry(bound, index));
+		}
+		else
+		{
+			if (pool[index].level < m)
+			{
+				counters.nodes_pruned++;
+			}
+			release(index);
+		}
+	};
+
+	size_t root = pool.allocate();
+	pool[root] = Node{0, 0, upper_bound(0, 0, 0), 0, no_parent, 0, false, true};
+	queue.push(QueueEntry(pool[root].bound, root));
+
+	while (!queue.empty())
+	{
+		size_t index = queue.top().second;
+		queue.pop();
+
+		// The node keeps its queued flag until its children exist, so that
+		// releasing a dead child cannot free it in the meantime.
+		Node node = pool[index];
+		if (node.bound <= best_defense)
+		{
+			counters.nodes_pruned++;
+			pool[index].queued = false;
+			release(index);
+			continue;
+		}
+		counters.nodes_explored++;
+
+		const size_t k = node.level;
+		if (node.cost + costs[k] <= total_cost)
+		{
+			// Taking an armor that fits whole leaves the relaxation unchanged.
+			add_child(index, true, node.cost + costs[k], node.defense + defenses[k], node.bound);
+		}
+		add_child(index, false, node.cost, node.defense, upper_bound(k + 1, node.cost, node.defense));
+
+		pool[index].queued = false;
+		release(index);
+	}
+
+	std::vector<size_t> selected;
+	for (size_t k = 0; k < m; k++)
+	{
+		if (chosen[k])
+		{
+			selected.push_back(order[k]);
+		}
+	}
+
+	if (stats)
+	{
+		*stats = counters;
+	}
+
+	return selection_from_indices(armors, std::move(selected));
+}
+
+// branch_and_bound_max_defense_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> branch_and_bound_max_defense(
+	const ArmorVector &armors,
+	double total_cost,
+	SearchStats *stats = nullptr)
+{
+	return materialize_selection(armors, branch_and_bound_max_defense_selection(armors, total_cost, stats));
+}
+
+// Compute a nearly optimal set of armor items with a fully polynomial-time
+// approximation scheme.
+// The returned selection fits within total_cost and its defense is at least
+// (1 - epsilon) times the optimum, for any 0 < epsilon < 1.
+// Let LB be the better of the greedy selection and the single best armor;
+// the optimum is at most 2 LB. Each defense is scaled down to an integer by
+// K = epsilon LB / m (m is the number of armors that could be chosen), and a
+// dynamic program over scaled defense finds the cheapest way to reach every
+// scaled total up to 2 LB / K. Rounding loses less than K per armor, so at
+// most epsilon LB overall. The DP takes O(m^2 / epsilon) time and keeps one
+// take/skip bit per cell for the reconstruction, so halving epsilon doubles
+// both time and memory.
+ArmorSelection fptas_max_defense_selection(
+	const ArmorVector &armors,
+	double total_cost,
+	double epsilon)
+{
+	PROFILE_SCOPE("fptas_max_defense");
+
+	assert(epsilon > 0 && epsilon < 1);
+
+	std::vector<size_t> candidates;
+	double best_single = 0;
+	for (size_t i = 0; i < armors.size(); i++)
+	{
+		if (armors[i]->cost() <= total_cost && armors[i]->defense() > 0)
+		{
+			candidates.push_back(i);
+			best_single = std::max(best_single, armors[i]->defense());
+		}
+	}
+
+	if (candidates.empty())
+	{
+		return ArmorSelection();
+	}
+
+	const double greedy_defense = greedy_max_defense_selection(armors, total_cost).total_defense;
+	const double lower_bound = std::max(greedy_defense, best_single);
+
+	const double scale = epsilon * lower_bound / candidates.size();
+	const size_t max_scaled = size_t(2 * lower_bound / scale) + 1;
+
+	// Armors that scale to zero cannot raise the scaled total, so the DP skips them.
+	std::vector<size_t> items;
+	std::vector<size_t> scaled;
+	for (size_t i : candidates)
+	{
+		size_t value = size_t(armors[i]->defense() / scale);
+		if (value > 0)
+		{
+			items.push_back(i);
+			scaled.push_back(std::min(value, max_scaled));
+		}
+	}
+
+	// min_cost[p] is the least gold that buys a scaled defense of exactly p.
+	std::vector<double> min_cost(max_scaled + 1, INFINITY);
+	min_cost[0] = 0;
+
+	// Bit p of row r of take says that items[r] was used to reach p.
+	const size_t row_words = (max_scaled + 64) / 64;
+	std::vector<uint64_t> take(items.size() * row_words, 0);
+
+	size_t reachable = 0;
+	for (size_t r = 0; r < items.size(); r++)
+	{
+		const double cost = armors[items[r]]->cost();
+		const size_t value = scaled[r];
+		uint64_t *row = &take[r * row_words];
+
+		reachable = std::min(max_scaled, reachable + value);
+		for (size_t p = reachable; p >= value; p--)
+		{
+			double candidate = min_cost[p - value] + cost;
+			if (candidate < min_cost[p] && candidate <= total_cost)
+			{
+				min_cost[p] = candidate;
+				row[p / 64] |= uint64_t(1) << (p % 64);
+			}
+			if (p == value)
+			{
+				break;
+			}
+		}
+	}
+
+	size_t p = max_scaled;
+	while (min_cost[p] > total_cost)
+	{
+		p--;
+	}
+
+	std::vector<size_t> selected;
+	for (size_t r = items.size(); r > 0 && p > 0; r--)
+	{
+		if ((take[(r - 1) * row_words + p / 64] >> (p % 64)) & 1)
+		{
+			selected.push_back(items[r - 1]);
+			p -= scaled[r - 1];
+		}
+	}
+
+	return selection_from_indices(armors, std::move(selected));
+}
+
+// fptas_max_defense_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> fptas_max_defense(
+	const ArmorVector &armors,
+	double total_cost,
+	double epsilon)
+{
+	return materialize_selection(armors, fptas_max_defense_selection(armors, total_cost, epsilon));
+}
+
+// Depth-first search state for dfs_max_defense. The armors are in order of
+// increasing cost, and suffix_defense[k] is the total defense of armors k..
+struct DfsSearch
+{
+	const std::vector<double> &costs;
+	const std::vector<double> &defenses;
+	const std::vector<double> &suffix_defense;
+	double total_cost;
+
+	std::vector<size_t> chosen, best;
+	double best_defense;
+	SearchStats stats;
+
+	// Visit the selection holding chosen, with the given totals, then every
+	// extension of it by armors from k on.
+	void visit(size_t k, double cost, double defense)
+	{
+		stats.nodes_explored++;
+
+		if (defense > best_defense)
+		{
+			best_defense = defense;
+			best = chosen;
+		}
+
+		for (size_t j = k; j < costs.size(); j++)
+		{
+			// Later armors cost at least as much, so none of them fits either.
+			if (cost + costs[j] > total_cost)
+			{
+				stats.nodes_pruned++;
+				break;
+			}
+			// Taking every armor left still could not beat the best.
+			if (defense + suffix_defense[j] <= best_defense)
+			{
+				stats.nodes_pruned++;
+				break;
+			}
+
+			chosen.push_back(j);
+			visit(j + 1, cost + costs[j], defense + defenses[j]);
+			chosen.pop_back();
+		}
+	}
+};
+
+// Compute the optimal set of armor items with a depth-first exhaustive search.
+// The armors with positive defense are ordered by increasing cost and each
+// subset is built by adding armors in that order, so a branch is abandoned
+// as soon as the next armor does not fit (no later one can), or when the
+// defense of all remaining armors could not lift it above the best subset
+// found so far. The answer has the same defense as exhaustive_max_defense,
+// but at tight budgets only a small part of the 2^n subsets is visited.
+// If stats is not null, the node counters are stored there.
+ArmorSelection dfs_max_defense_selection(
+	const ArmorVector &armors,
+	double total_cost,
+	SearchStats *stats = nullptr)
+{
+	PROFILE_SCOPE("dfs_max_defense");
+
+	std::vector<size_t> order;
+	for (size_t i = 0; i < armors.size(); i++)
+	{
+		if (armors[i]->defense() > 0)
+		{
+			order.push_back(i);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return armors[a]->cost() < armors[b]->cost();
+	});
+
+	const size_t m = order.size();
+	std::vector<double> costs(m), defenses(m), suffix_defense(m + 1, 0);
+	for (size_t k = 0; k < m; k++)
+	{
+		costs[k] = armors[order[k]]->cost();
+		defenses[k] = armors[order[k]]->defense();
+	}
+	for (size_t k = m; k > 0; k--)
+	{
+		suffix_defense[k - 1] = suffix_defense[k] + defenses[k - 1];
+	}
+
+	DfsSearch search{costs, defenses, suffix_defense, total_cost, {}, {}, 0, SearchStats()};
+	search.visit(0, 0, 0);
+
+	std::vector<size_t> selected;
+	for (size_t k : search.best)
+	{
+		selected.push_back(order[k]);
+	}
+
+	if (stats)
+	{
+		*stats = search.stats;
+	}
+
+	return selection_from_indices(armors, std::move(selected));
+}
+
+// dfs_max_defense_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> dfs_max_defense(
+	const ArmorVector &armors,
+	double total_cost,
+	SearchStats *stats = nullptr)
+{
+	return materialize_selection(armors, dfs_max_defense_selection(armors, total_cost, stats));
+}
+
+// Run exhaustive_max_defense over one shard of the search, the subsets at
+// positions [first, last) of the Gray code order, and return the best one as
+// a small mergeable record. Shards covering [0, 2^n) can run in separate
+// threads, processes or hosts; combining their records with
+// exhaustive_merge gives the same subset as exhaustive_max_defense.
+ExhaustiveBest exhaustive_max_defense_shard(
+	const ArmorVector &armors,
+	double total_cost,
+	uint64_t first,
+	uint64_t last)
+{
+	const int n = armors.size();
+	assert(n < 64);
+	assert(first <= last && last <= (uint64_t(1) << n));
+
+	std::vector<double> costs, defenses;
+	split_armor_vector(armors, costs, defenses);
+
+	return exhaustive_scan(costs, defenses, total_cost, first, last);
+}
+
+// One shard's result together with what it was a shard of: the instance
+// size n, the budget, and the [first, last) range it covered. Records from
+// different runs, or missing or overlapping shards, can then be told apart
+// when they are merged.
+struct ShardRecord
+{
+	int n = 0;
+	double total_cost = 0;
+	uint64_t first = 0;
+	uint64_t last = 0;
+	ExhaustiveBest best;
+};
+
+// Write a shard record as one line of text. The budget and totals are
+// written as hex floats so a record read back with parse_shard_result is
+// bit-for-bit the same.
+std::string format_shard_result(const ShardRecord &record)
+{
+	char total_cost[64], cost[64], defense[64];
+	std::snprintf(total_cost, sizeof(total_cost), "%a", record.total_cost);
+	std::snprintf(cost, sizeof(cost), "%a", record.best.cost);
+	std::snprintf(defense, sizeof(defense), "%a", record.best.defense);
+
+	std::stringstream ss;
+	ss << "n " << record.n << " budget " << total_cost
+		<< " first " << record.first << " last " << record.last
+		<< " found " << record.best.found << " mask " << record.best.mask
+		<< " cost " << cost << " defense " << defense;
+	return ss.str();
+}
+
+// Read back a line written by format_shard_result.
+// Returns false if the line is not a valid record.
+bool parse_shard_result(const std::string &line, ShardRecord &record)
+{
+	std::stringstream ss(line);
+	std::string n_key, budget_key, first_key, last_key, found_key, mask_key, cost_key, defense_key;
+	std::string total_cost, cost, defense;
+	ss >> n_key >> record.n >> budget_key >> total_cost
+		>> first_key >> record.first >> last_key >> record.last
+		>> found_key >> record.best.found >> mask_key >> record.best.mask
+		>> cost_key >> cost >> defense_key >> defense;
+	if (!ss || n_key != "n" || budget_key != "budget" || first_key != "first" || last_key != "last"
+		|| found_key != "found" || mask_key != "mask" || cost_key != "cost" || defense_key != "defense")
+	{
+		return false;
+	}
+
+	char *end;
+	record.total_cost = std::strtod(total_cost.c_str(), &end);
+	if (*end != '\0')
+	{
+		return false;
+	}
+	record.best.cost = std::strtod(cost.c_str(), &end);
+	if (*end != '\0')
+	{
+		return false;
+	}
+	record.best.defense = std::strtod(defense.c_str(), &end);
+	return *end == '\0';
+}
+
+// Merge shard records into best, after checking that they all belong to
+// the same instance and budget and that their ranges tile [0, 2^n) exactly,
+// with nothing missing and nothing counted twice.
+// Returns false, with a reason in error, if they do not.
+bool merge_shard_records(
+	std::vector<ShardRecord> records,
+	int n,
+	double total_cost,
+	ExhaustiveBest &best,
+	std::string &error)
+{
+	if (n < 0 || n >= 64)
+	{
+		error = "n out of range";
+		return false;
+	}
+
+	for (auto &record : records)
+	{
+		if (record.n != n || record.total_cost != total_cost)
+		{
+			error = "record is for a different instance or budget";
+			return false;
+		}
+	}
+
+	std::sort(records.begin(), records.end(),
+		[](const ShardRecord &a, const ShardRecord &b) { return a.first < b.first; });
+
+	uint64_t next = 0;
+	for (auto &record : records)
+	{
+		if (record.last < record.first)
+		{
+			error = "shard range ends before it starts at " + std::to_string(record.first);
+			return false;
+		}
+		if (record.first > next)
+		{
+			error = "shards leave a gap at " + std::to_string(next);
+			return false;
+		}
+		if (record.first < next)
+		{
+			error = "shards overlap at " + std::to_string(record.first);
+			return false;
+		}
+		next = record.last;
+	}
+	if (next != (uint64_t(1) << n))
+	{
+		error = "shards end at " + std::to_string(next) + " instead of " + std::to_string(uint64_t(1) << n);
+		return false;
+	}
+
+	best = ExhaustiveBest();
+	for (auto &record : records)
+	{
+		exhaustive_merge(best, record.best);
+	}
+	return true;
+}
+
+// The filter_armor_vector criteria, applied to rows as they stream in:
+// keep armors whose defense is in [min_defense, max_defense], up to
+// total_size of them.
+struct StreamFilter
+{
+	double min_defense = -INFINITY;
+	double max_defense = INFINITY;
+	size_t total_size = SIZE_MAX;
+};
+
+// An armor held by the streaming greedy stage. line is its data line
+// number, counting from zero and including rows that were invalid, so it
+// is the catalog index of load_armor_database only when no row was skipped.
+struct StreamedArmor
+{
+	std::string description;
+	double cost;
+	double defense;
+	double ratio;
+	size_t line;
+};
+
+// Counters from stream_greedy_max_defense.
+struct StreamStats
+{
+	size_t rows = 0;
+	size_t invalid = 0;
+	size_t accepted = 0;
+	size_t kept = 0;
+	size_t dropped = 0;
+	size_t peak_bytes = 0;
+};
+
+// Result of the streaming greedy stage: the chosen armors in the order
+// greedy takes them. exact is true when the answer is provably the one
+// greedy_max_defense would give on every accepted row, i.e. nothing was
+// dropped or no dropped armor could have fit in the gold left over.
+struct StreamSelection
+{
+	std::vector<StreamedArmor> items;
+	double total_cost = 0;
+	double total_defense = 0;
+	bool exact = true;
+};
+
+// Online stage of the streaming pipeline: keeps the armors with the best
+// defense/cost ratio in a heap whose worst entry is on top, and evicts the
+// worst whenever the entries would take more than memory_limit bytes.
+//
+// The bytes counted are the heap array's whole capacity plus the kept
+// descriptions. The array grows under the stage's own control, and only
+// when the old and new arrays fit in memory_limit together, so the ceiling
+// holds during a reallocation too; peak_bytes includes that moment.
+//
+// Entries differ in size with their descriptions, so evicting one large
+// entry can make room for a later armor with a worse ratio. To keep the
+// kept armors a prefix of the greedy ordering, every armor whose ratio is
+// at or below the best one dropped so far is dropped on arrival. Greedy
+// over the kept armors is then greedy over the whole stream up to the
+// point where it would reach the first dropped armor.
+class GreedyTopK
+{
+	//
+public:
+	//
+	explicit GreedyTopK(size_t memory_limit) : _memory_limit(memory_limit) { }
+
+	void push(StreamedArmor armor)
+	{
+		// Armor with no defense never improves the total.
+		if (!(armor.ratio > 0))
+		{
+			return;
+		}
+
+		if (armor.ratio <= _dropped_best_ratio)
+		{
+			drop(armor);
+			return;
+		}
+
+		armor.description.shrink_to_fit();
+		const size_t description = armor.description.capacity();
+		if (_heap.size() == _heap.capacity())
+		{
+			grow(description);
+		}
+
+		// Make room by evicting kept armors that are worse than this one;
+		// if that is not enough, this one is the worst and goes instead.
+		auto full = [&] {
+			return _heap.size() == _heap.capacity() || bytes() + description > _memory_limit;
+		};
+		while (full() && !_heap.empty() && Better()(armor, _heap.front()))
+		{
+			evict_worst();
+		}
+		if (full())
+		{
+			_dropped_best_ratio = std::max(_dropped_best_ratio, armor.ratio);
+			drop(armor);
+			return;
+		}
+
+		_description_bytes += description;
+		_heap.push_back(std::move(armor));
+		std::push_heap(_heap.begin(), _heap.end(), Better());
+		_peak_bytes = std::max(_peak_bytes, bytes());
+	}
+
+	size_t kept() const { return _heap.size(); }
+	size_t dropped() const { return _dropped; }
+	size_t peak_bytes() const { return _peak_bytes; }
+
+	// Run greedy over the kept armors, best ratio first. The armors are
+	// sorted in place, with no copy, and the heap is rebuilt afterwards.
+	//
+	// Full greedy would go on to the dropped armors with the gold left over
+	// after the kept ones, so the answer is exact when the cheapest dropped
+	// armor does not fit in it.
+	StreamSelection select(double total_cost)
+	{
+		std::sort(_heap.begin(), _heap.end(), Better());
+
+		StreamSelection selection;
+		for (auto &armor : _heap)
+		{
+			if (armor.cost + selection.total_cost <= total_cost)
+			{
+				selection.total_cost += armor.cost;
+				selection.total_defense += armor.defense;
+				selection.items.push_back(armor);
+			}
+		}
+		selection.exact = _dropped == 0 || selection.total_cost + _dropped_min_cost > total_cost;
+
+		std::make_heap(_heap.begin(), _heap.end(), Better());
+		return selection;
+	}
+
+	//
+private:
+	// Greater ratio first, ties in line order, as in greedy_ratio_order;
+	// as a heap comparison it puts the worst armor on top.
+	struct Better
+	{
+		bool operator()(const StreamedArmor &a, const StreamedArmor &b) const
+		{
+			return a.ratio != b.ratio ? a.ratio > b.ratio : a.line < b.line;
+		}
+	};
+
+	size_t bytes() const
+	{
+		return _heap.capacity() * sizeof(StreamedArmor) + _description_bytes;
+	}
+
+	// Double the heap array, or grow it as far as memory_limit allows while
+	// the old array and a description of the given size are also held.
+	void grow(size_t description)
+	{
+		const size_t capacity = _heap.capacity();
+		const size_t held = capacity * sizeof(StreamedArmor) + _description_bytes + description;
+		if (held >= _memory_limit)
+		{
+			return;
+		}
+		const size_t target = std::min(std::max<size_t>(2 * capacity, 1), (_memory_limit - held) / sizeof(StreamedArmor));
+		if (target > capacity)
+		{
+			_heap.reserve(target);
+			_peak_bytes = std::max(_peak_bytes, held - description + target * sizeof(StreamedArmor));
+		}
+	}
+
+	void evict_worst()
+	{
+		std::pop_heap(_heap.begin(), _heap.end(), Better());
+		_description_bytes -= _heap.back().description.capacity();
+		_dropped_best_ratio = std::max(_dropped_best_ratio, _heap.back().ratio);
+		drop(_heap.back());
+		_heap.pop_back();
+	}
+
+	void drop(const StreamedArmor &armor)
+	{
+		_dropped_min_cost = std::min(_dropped_min_cost, armor.cost);
+		_dropped++;
+	}
+
+	size_t _memory_limit;
+	size_t _description_bytes = 0;
+	size_t _peak_bytes = 0;
+	size_t _dropped = 0;
+	double _dropped_min_cost = INFINITY;
+	double _dropped_best_ratio = 0;
+	std::vector<StreamedArmor> _heap;
+};
+
+// Streaming pipeline: read armor database rows from input one line at a
+// time (a file, a pipe or std::cin; nothing is seeked or materialized),
+// apply filter, and feed the accepted rows to a GreedyTopK holding at most
+// memory_limit bytes of armor. Rows with missing fields or invalid values
+// are counted and skipped. Returns false if input had no header row.
+bool stream_greedy_max_defense(
+	std::istream &input,
+	const StreamFilter &filter,
+	double total_cost,
+	size_t memory_limit,
+	StreamSelection &selection,
+	StreamStats *stats = nullptr)
+{
+	PROFILE_SCOPE("stream_greedy_max_defense");
+
+	StreamStats counters;
+	GreedyTopK top(memory_limit);
+
+	std::string line;
+	if (!std::getline(input, line))
+	{
+		return false;
+	}
+
+	while (counters.accepted < filter.total_size && std::getline(input, line))
+	{
+		StreamedArmor armor;
+		size_t field_count;
+		armor.line = counters.rows++;
+		if (!parse_armor_row(line, armor.description, armor.cost, armor.defense, field_count) || !(armor.cost > 0))
+		{
+			counters.invalid++;
+			continue;
+		}
+
+		if (armor.defense >= filter.min_defense && armor.defense <= filter.max_defense)
+		{
+			counters.accepted++;
+			armor.ratio = armor.defense / armor.cost;
+			top.push(std::move(armor));
+		}
+	}
+
+	selection = top.select(total_cost);
+
+	counters.kept = top.kept();
+	counters.dropped = top.dropped();
+	counters.peak_bytes = top.peak_bytes();
+	if (stats)
+	{
+		*stats = counters;
+	}
+	return true;
 }
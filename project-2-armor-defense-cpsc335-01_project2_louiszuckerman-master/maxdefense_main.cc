@@ -1,11 +1,286 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxdefense_main.cc
+//
+// Experiment driver for maxdefense.hh. The default "sweep" mode times every
+// solver over growing n and writes one CSV row per (solver, n), ready for
+// plotting empirical time curves.
+//
+///////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "maxdefense.hh"
+#include "timer.hh"
 
 
-int main()
+// One solver in the sweep, with the input sizes it is timed on.
+struct SweepSolver
 {
-	return 0;
+	std::string name;
+	std::vector<int> sizes;
+	std::function<ArmorSelection(const ArmorVector &, double)> solve;
+};
+
+// Settings for the sweep, see usage in main.
+struct SweepOptions
+{
+	double budget = 2000;
+	int warmup = 1;
+	int repeats = 5;
+	double max_seconds = 10;
+	std::string output;
+};
+
+// Sizes first, first * factor, ... up to last, then last itself.
+std::vector<int> geometric_sizes(int first, int last, double factor)
+{
+	std::vector<int> sizes;
+	for (double n = first; n < last; n *= factor)
+	{
+		sizes.push_back(int(n));
+	}
+	sizes.push_back(last);
+	return sizes;
+}
+
+// Time each solver on the first n armors of the catalog for each of its sizes.
+// Every point is run warmup times untimed, then repeats times with a fresh
+// Timer each, and reported as the median with the min and max as spread.
+// A solver stops growing once its median passes max_seconds.
+void sweep(const ArmorVector &all_armors, const SweepOptions &options)
+{
+	const int catalog = all_armors.size();
+
+	std::vector<SweepSolver> solvers = {
+		{"greedy", geometric_sizes(100, catalog, 2), greedy_max_defense_selection},
+		{"greedy_fixed", geometric_sizes(100, catalog, 2),
+		 [](const ArmorVector &armors, double budget) { return greedy_max_defense_table(make_fixed_point_table(armors), budget); }},
+		{"exhaustive", geometric_sizes(4, 26, 1.25), exhaustive_max_defense_selection},
+		{"exhaustive_fixed", geometric_sizes(4, 26, 1.25),
+		 [](const ArmorVector &armors, double budget) { return exhaustive_max_defense_table(make_fixed_point_table(armors), budget); }},
+		{"exhaustive_simd", geometric_sizes(4, 30, 1.25),
+		 [](const ArmorVector &armors, double budget) { return exhaustive_max_defense_simd_selection(armors, budget); }},
+		{"exhaustive_parallel", geometric_sizes(4, 28, 1.25),
+		 [](const ArmorVector &armors, double budget) { return exhaustive_max_defense_parallel_selection(armors, budget); }},
+		{"mitm", geometric_sizes(4, 44, 1.25), mitm_max_defense_selection},
+		{"dfs", geometric_sizes(4, 60, 1.25),
+		 [](const ArmorVector &armors, double budget) { return dfs_max_defense_selection(armors, budget); }},
+		{"branch_and_bound", geometric_sizes(100, catalog, 2),
+		 [](const ArmorVector &armors, double budget) { return branch_and_bound_max_defense_selection(armors, budget); }},
+		{"fptas_0.1", geometric_sizes(100, catalog, 2),
+		 [](const ArmorVector &armors, double budget) { return fptas_max_defense_selection(armors, budget, 0.1); }},
+	};
+
+	std::ofstream file;
+	if (!options.output.empty())
+	{
+		file.open(options.output);
+		if (!file)
+		{
+			std::cout << "Cannot open output file: " << options.output << std::endl;
+			return;
+		}
+	}
+	std::ostream &csv = options.output.empty() ? std::cout : file;
+
+	csv << "solver,n,budget,repeats,median_seconds,min_seconds,max_seconds,defense" << std::endl;
+
+	for (auto &solver : solvers)
+	{
+		for (int n : solver.sizes)
+		{
+			auto armors = filter_armor_vector(all_armors, 1, 2500, n);
+
+			ArmorSelection selection;
+			for (int w = 0; w < options.warmup; w++)
+			{
+				selection = solver.solve(*armors, options.budget);
+			}
+
+			std::vector<double> times;
+			for (int r = 0; r < options.repeats; r++)
+			{
+				Timer timer;
+				selection = solver.solve(*armors, options.budget);
+				times.push_back(timer.elapsed());
+			}
+			std::sort(times.begin(), times.end());
+
+			const size_t middle = times.size() / 2;
+			double median = times.size() % 2 ? times[middle] : (times[middle - 1] + times[middle]) / 2;
+
+			csv
+				<< solver.name << ','
+				<< armors->size() << ','
+				<< options.budget << ','
+				<< times.size() << ','
+				<< median << ','
+				<< times.front() << ','
+				<< times.back() << ','
+				<< selection.total_defense
+				<< std::endl;
+
+			if (median > options.max_seconds)
+			{
+				break;
+			}
+		}
+	}
 }
 
 
+// Scaling benchmark for exhaustive_max_defense_parallel: solve the same
+// n-item instance with 1, 2, 4, ... threads up to the number of cores and
+// report the time and speedup over one thread.
+void benchmark_parallel_scaling(const ArmorVector &all_armors, int n, double budget)
+{
+	auto armors = filter_armor_vector(all_armors, 1, 2500, n);
+
+	unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+	double single_thread = 0;
+	for (unsigned threads = 1;; threads = std::min(threads * 2, cores))
+	{
+		Timer timer;
+		auto soln = exhaustive_max_defense_parallel(*armors, budget, threads);
+		double elapsed = timer.elapsed();
+
+		if (threads == 1)
+		{
+			single_thread = elapsed;
+		}
+
+		double cost, defense;
+		sum_armor_vector(*soln, cost, defense);
+		std::cout
+			<< "Exhaustive n: " << n
+			<< " Threads: " << threads
+			<< " Time: " << elapsed
+			<< " Speedup: " << single_thread / elapsed
+			<< " Defense: " << defense
+			<< std::endl;
+
+		if (threads == cores)
+		{
+			break;
+		}
+	}
+}
+
+// Answer quality of fptas_max_defense against the exact optimum from
+// branch_and_bound_max_defense, for a range of epsilon values.
+void benchmark_fptas_quality(const ArmorVector &all_armors, int n, double budget)
+{
+	auto armors = filter_armor_vector(all_armors, 1, 2500, n);
+
+	Timer timer;
+	auto exact = branch_and_bound_max_defense(*armors, budget);
+	double exact_elapsed = timer.elapsed();
+
+	double exact_cost, exact_defense;
+	sum_armor_vector(*exact, exact_cost, exact_defense);
+	std::cout
+		<< "Branch and bound n: " << n
+		<< " Time: " << exact_elapsed
+		<< " Defense: " << exact_defense
+		<< std::endl;
+
+	for (double epsilon : {0.5, 0.2, 0.1, 0.05, 0.02})
+	{
+		timer.reset();
+		auto soln = fptas_max_defense(*armors, budget, epsilon);
+		double elapsed = timer.elapsed();
+
+		double cost, defense;
+		sum_armor_vector(*soln, cost, defense);
+		std::cout
+			<< "FPTAS n: " << n
+			<< " Epsilon: " << epsilon
+			<< " Time: " << elapsed
+			<< " Defense: " << defense
+			<< " Ratio: " << defense / exact_defense
+			<< std::endl;
+	}
+}
+
+// Usage:
+//	experiment [sweep] [--budget B] [--warmup W] [--repeats R] [--max-seconds S] [--output file.csv]
+//	experiment scaling [n] [budget]
+//	experiment fptas [n] [budget]
+int main(int argc, char *argv[])
+{
+	std::string mode = argc > 1 && argv[1][0] != '-' ? argv[1] : "sweep";
+
+	auto all_armors = load_armor_database("armor.csv");
+	if (!all_armors)
+	{
+		return 1;
+	}
+
+	if (mode == "sweep")
+	{
+		SweepOptions options;
+		for (int i = argc > 1 && argv[1][0] != '-' ? 2 : 1; i < argc; i += 2)
+		{
+			std::string flag = argv[i];
+			if (i + 1 >= argc)
+			{
+				std::cout << "Missing value for " << flag << std::endl;
+				return 1;
+			}
+			std::string value = argv[i + 1];
+
+			if (flag == "--budget")
+			{
+				options.budget = std::stod(value);
+			}
+			else if (flag == "--warmup")
+			{
+				options.warmup = std::stoi(value);
+			}
+			else if (flag == "--repeats")
+			{
+				options.repeats = std::max(1, std::stoi(value));
+			}
+			else if (flag == "--max-seconds")
+			{
+				options.max_seconds = std::stod(value);
+			}
+			else if (flag == "--output")
+			{
+				options.output = value;
+			}
+			else
+			{
+				std::cout << "Unknown option: " << flag << std::endl;
+				return 1;
+			}
+		}
+		sweep(*all_armors, options);
+	}
+	else if (mode == "scaling")
+	{
+		int n = argc > 2 ? std::stoi(argv[2]) : 26;
+		double budget = argc > 3 ? std::stod(argv[3]) : 2000;
+		benchmark_parallel_scaling(*all_armors, n, budget);
+	}
+	else if (mode == "fptas")
+	{
+		int n = argc > 2 ? std::stoi(argv[2]) : all_armors->size();
+		double budget = argc > 3 ? std::stod(argv[3]) : 5000;
+		benchmark_fptas_quality(*all_armors, n, budget);
+	}
+	else
+	{
+		std::cout << "Unknown mode: " << mode << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,683 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxdefense_service.cc
+//
+// Long-running armor query service. The catalog is loaded once and the
+// greedy index is kept warm, then queries are answered from standard input
+// or from clients of a Unix domain socket, one line per query:
+//
+//	<id> <solver> <budget> [<min_defense> <max_defense> [<limit>]]
+//
+// solver is one of greedy, exhaustive, mitm, dfs, bnb or fptas:<epsilon>.
+// The optional filter keeps armors whose defense is in [min_defense,
+// max_defense], and only the first limit of them, like filter_armor_vector.
+// Each query gets one line back, in completion order:
+//
+//	<id> ok cost=<gold> defense=<points> count=<k> items=<i,j,...> micros=<latency>
+//	<id> error <message>
+//
+// where items are catalog indices (row number minus two in the CSV).
+// Queries are served by a pool of worker threads. A worker takes either a
+// batch of waiting unfiltered greedy queries, answered together with a
+// single GreedyIndex::query_batch, or one query for any other solver, so
+// greedy answers never wait behind slow solvers and slow queries spread
+// over the whole pool.
+//
+// Each solver has a limit on the armors it will take (and fptas on
+// epsilon), so that no single query can exhaust the service's memory; see
+// check_limits.
+//
+// In socket mode the service runs until SIGINT or SIGTERM, then stops
+// accepting, lets the clients' pending queries finish and exits.
+//
+// Usage: service [--catalog armor.csv] [--socket path] [--workers N] [--batch N]
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "maxdefense.hh"
+#include "timer.hh"
+
+
+// Where the answers to one client go. Workers write whole lines under the
+// lock, so concurrent answers never interleave.
+class Connection
+{
+	//
+public:
+	//
+	Connection(int fd, bool owned) : _fd(fd), _owned(owned) { }
+
+	~Connection()
+	{
+		if (_owned)
+		{
+			close(_fd);
+		}
+	}
+
+	// Stop reading from the client, so that its reader thread sees end of
+	// file. Answers to queries already queued can still be written; the
+	// descriptor is closed when the last of them lets go of the connection.
+	void shutdown()
+	{
+		::shutdown(_fd, SHUT_RD);
+	}
+
+	void send(const std::string &line)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::string data = line + "\n";
+		for (size_t sent = 0; sent < data.size();)
+		{
+			ssize_t n = write(_fd, data.data() + sent, data.size() - sent);
+			if (n <= 0)
+			{
+				return;
+			}
+			sent += n;
+		}
+	}
+
+	//
+private:
+	int _fd;
+	bool _owned;
+	std::mutex _mutex;
+};
+
+// A parsed query line.
+struct ParsedQuery
+{
+	std::string id;
+	std::string solver;
+	double budget = 0;
+	bool filtered = false;
+	double min_defense = 0;
+	double max_defense = 0;
+	size_t limit = SIZE_MAX;
+	double epsilon = 0;
+};
+
+bool parse_query(const std::string &line, ParsedQuery &query, std::string &error)
+{
+	std::stringstream ss(line);
+	if (!(ss >> query.id >> query.solver >> query.budget))
+	{
+		error = "expected: <id> <solver> <budget> [<min_defense> <max_defense> [<limit>]]";
+		return false;
+	}
+
+	if (ss >> query.min_defense)
+	{
+		if (!(ss >> query.max_defense))
+		{
+			error = "min_defense without max_defense";
+			return false;
+		}
+		query.filtered = true;
+
+		long long limit;
+		if (ss >> limit)
+		{
+			query.limit = limit < 0 ? 0 : limit;
+		}
+	}
+
+	if (query.solver.compare(0, 6, "fptas:") == 0)
+	{
+		query.epsilon = std::atof(query.solver.c_str() + 6);
+		query.solver = "fptas";
+		if (!(query.epsilon > 0 && query.epsilon < 1))
+		{
+			error = "fptas epsilon must be between 0 and 1";
+			return false;
+		}
+	}
+	return true;
+}
+
+// One query line waiting for a worker, parsed on arrival, with the clock
+// started on arrival. error is set when the line did not parse.
+struct Query
+{
+	ParsedQuery parsed;
+	std::string error;
+	std::shared_ptr<Connection> connection;
+	Timer received;
+
+	Query(const std::string &line, std::shared_ptr<Connection> connection)
+		: connection(std::move(connection))
+	{
+		parse_query(line, parsed, error);
+	}
+
+	// Unfiltered greedy queries are answered together by one
+	// GreedyIndex::query_batch; everything else is answered on its own.
+	bool batched() const
+	{
+		return error.empty() && parsed.solver == "greedy" && !parsed.filtered;
+	}
+};
+
+// Queries waiting for the worker pool. Batched greedy queries wait apart
+// from the rest, so a cheap greedy answer never sits behind a slow solver,
+// and slow queries go out one per worker so the whole pool shares them.
+class QueryQueue
+{
+	//
+public:
+	//
+	void push(Query query)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			(query.batched() ? _greedy : _others).push_back(std::move(query));
+		}
+		_ready.notify_one();
+	}
+
+	// Wait for queries, then take up to max waiting greedy queries if there
+	// are any, or else a single other query. Returns an empty batch once the
+	// queue is closed and drained.
+	std::vector<Query> pop_batch(size_t max)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_ready.wait(lock, [&] { return _closed || !_greedy.empty() || !_others.empty(); });
+
+		std::vector<Query> batch;
+		while (!_greedy.empty() && batch.size() < max)
+		{
+			batch.push_back(std::move(_greedy.front()));
+			_greedy.pop_front();
+		}
+		if (batch.empty() && !_others.empty())
+		{
+			batch.push_back(std::move(_others.front()));
+			_others.pop_front();
+		}
+		return batch;
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_closed = true;
+		}
+		_ready.notify_all();
+	}
+
+	//
+private:
+	std::mutex _mutex;
+	std::condition_variable _ready;
+	std::deque<Query> _greedy;
+	std::deque<Query> _others;
+	bool _closed = false;
+};
+
+// The warm state shared by all workers; read-only once built.
+struct Catalog
+{
+	std::unique_ptr<ArmorVector> armors;
+	std::unique_ptr<GreedyIndex> greedy;
+};
+
+std::string format_answer(const std::string &id, const ArmorSelection &selection, const Timer &received)
+{
+	std::stringstream ss;
+	ss << id << " ok cost=" << selection.total_cost
+	   << " defense=" << selection.total_defense
+	   << " count=" << selection.indices.size()
+	   << " items=";
+	for (size_t k = 0; k < selection.indices.size(); k++)
+	{
+		ss << (k ? "," : "") << selection.indices[k];
+	}
+	ss << " micros=" << int64_t(received.elapsed() * 1e6);
+	return ss.str();
+}
+
+// Largest instances a query may ask for. exhaustive keeps O(n) memory but
+// runs 2^n steps. mitm stores 2^(n/2) subsets of 24 bytes per half, about
+// 50 MB at 40 armors. dfs runs up to 2^n nodes. bnb and fptas are bounded by
+// the catalog size, and fptas also by its take-bit matrix of about
+// n * 2n / epsilon bits.
+const size_t exhaustive_max_armors = 32;
+const size_t mitm_max_armors = 40;
+const size_t dfs_max_armors = 60;
+const size_t bnb_max_armors = 10000;
+const size_t fptas_max_armors = 10000;
+const double fptas_min_epsilon = 0.01;
+const double fptas_max_bits = 8.0 * (256 << 20);
+
+// Return an error message if the query is too large for its solver, or
+// an empty string.
+std::string check_limits(const ParsedQuery &query, size_t n)
+{
+	auto too_many = [&](size_t limit) {
+		return n > limit
+				   ? query.solver + " needs at most " + std::to_string(limit) + " armors; add a filter"
+				   : std::string();
+	};
+
+	if (query.solver == "exhaustive")
+	{
+		return too_many(exhaustive_max_armors);
+	}
+	if (query.solver == "mitm")
+	{
+		return too_many(mitm_max_armors);
+	}
+	if (query.solver == "dfs")
+	{
+		return too_many(dfs_max_armors);
+	}
+	if (query.solver == "bnb")
+	{
+		return too_many(bnb_max_armors);
+	}
+	if (query.solver == "fptas")
+	{
+		if (query.epsilon < fptas_min_epsilon)
+		{
+			std::stringstream ss;
+			ss << "fptas epsilon must be at least " << fptas_min_epsilon;
+			return ss.str();
+		}
+		if (double(n) * 2 * n / query.epsilon > fptas_max_bits)
+		{
+			return "fptas with this epsilon needs fewer armors; add a filter or raise epsilon";
+		}
+		return too_many(fptas_max_armors);
+	}
+	return std::string();
+}
+
+// Answer one query that is not served through the batched greedy path.
+std::string answer(const Catalog &catalog, const ParsedQuery &query, const Timer &received)
+{
+	// Filter without copying the armors, remembering their catalog indices.
+	const ArmorVector *armors = catalog.armors.get();
+	ArmorVector subset;
+	std::vector<size_t> catalog_index;
+	if (query.filtered)
+	{
+		for (size_t i = 0; i < catalog.armors->size() && subset.size() < query.limit; i++)
+		{
+			double defense = (*catalog.armors)[i]->defense();
+			if (defense >= query.min_defense && defense <= query.max_defense)
+			{
+				subset.push_back((*catalog.armors)[i]);
+				catalog_index.push_back(i);
+			}
+		}
+		armors = &subset;
+	}
+
+	std::string error = check_limits(query, armors->size());
+	if (!error.empty())
+	{
+		return query.id + " error " + error;
+	}
+
+	ArmorSelection selection;
+	if (query.solver == "greedy")
+	{
+		selection = greedy_max_defense_selection(*armors, query.budget);
+	}
+	else if (query.solver == "exhaustive")
+	{
+		selection = exhaustive_max_defense_selection(*armors, query.budget);
+	}
+	else if (query.solver == "mitm")
+	{
+		selection = mitm_max_defense_selection(*armors, query.budget);
+	}
+	else if (query.solver == "dfs")
+	{
+		selection = dfs_max_defense_selection(*armors, query.budget);
+	}
+	else if (query.solver == "bnb")
+	{
+		selection = branch_and_bound_max_defense_selection(*armors, query.budget);
+	}
+	else if (query.solver == "fptas")
+	{
+		selection = fptas_max_defense_selection(*armors, query.budget, query.epsilon);
+	}
+	else
+	{
+		return query.id + " error unknown solver " + query.solver;
+	}
+
+	if (query.filtered)
+	{
+		for (size_t &i : selection.indices)
+		{
+			i = catalog_index[i];
+		}
+	}
+	return format_answer(query.id, selection, received);
+}
+
+// Worker loop: take batches until the queue is closed. A batch is either
+// greedy queries, answered with one query_batch, or a single other query.
+void serve(const Catalog &catalog, QueryQueue &queue, size_t batch_size)
+{
+	for (;;)
+	{
+		std::vector<Query> batch = queue.pop_batch(batch_size);
+		if (batch.empty())
+		{
+			return;
+		}
+
+		std::vector<size_t> greedy_queries;
+		std::vector<double> greedy_budgets;
+
+		for (size_t q = 0; q < batch.size(); q++)
+		{
+			const Query &query = batch[q];
+			if (!query.error.empty())
+			{
+				std::string id = query.parsed.id.empty() ? "-" : query.parsed.id;
+				query.connection->send(id + " error " + query.error);
+			}
+			else if (query.batched())
+			{
+				greedy_queries.push_back(q);
+				greedy_budgets.push_back(query.parsed.budget);
+			}
+			else
+			{
+				query.connection->send(answer(catalog, query.parsed, query.received));
+			}
+		}
+
+		if (!greedy_queries.empty())
+		{
+			GreedyBatch answers = catalog.greedy->query_batch(greedy_budgets);
+			for (size_t g = 0; g < greedy_queries.size(); g++)
+			{
+				const GreedyAnswer &a = answers.answers[g];
+				ArmorSelection selection;
+				selection.total_cost = a.total_cost;
+				selection.total_defense = a.total_defense;
+				for (size_t r = a.first_range; r < a.first_range + a.range_count; r++)
+				{
+					for (size_t k = answers.ranges[r].begin; k < answers.ranges[r].end; k++)
+					{
+						selection.indices.push_back(catalog.greedy->catalog_index(k));
+					}
+				}
+
+				Query &query = batch[greedy_queries[g]];
+				query.connection->send(format_answer(query.parsed.id, selection, query.received));
+			}
+		}
+	}
+}
+
+// Read query lines from fd until end of file and queue them.
+void read_queries(int fd, std::shared_ptr<Connection> connection, QueryQueue &queue)
+{
+	std::string pending;
+	char buffer[4096];
+	for (;;)
+	{
+		ssize_t n = read(fd, buffer, sizeof(buffer));
+		if (n <= 0)
+		{
+			break;
+		}
+		pending.append(buffer, n);
+
+		size_t start = 0;
+		for (size_t end; (end = pending.find('\n', start)) != std::string::npos; start = end + 1)
+		{
+			std::string line = pending.substr(start, end - start);
+			if (!line.empty() && line.back() == '\r')
+			{
+				line.pop_back();
+			}
+			if (!line.empty())
+			{
+				queue.push(Query(line, connection));
+			}
+		}
+		pending.erase(0, start);
+	}
+	if (!pending.empty())
+	{
+		queue.push(Query(pending, connection));
+	}
+}
+
+// Set by SIGINT and SIGTERM to stop the socket listener.
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int)
+{
+	stop_requested = 1;
+}
+
+// A client of the socket listener and the thread reading its queries.
+struct Client
+{
+	std::thread reader;
+	std::shared_ptr<Connection> connection;
+	std::shared_ptr<std::atomic<bool>> done;
+};
+
+// Accept clients on a Unix domain socket, one reader thread each, until a
+// stop is requested. Then stop reading from the clients and join their
+// readers, so no more queries arrive once this returns. Their sockets stay
+// open for the answers the worker pool still owes them.
+int listen_on_socket(const std::string &path, QueryQueue &queue)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Socket path too long: " << path << std::endl;
+		return 1;
+	}
+	std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+	{
+		std::cerr << "Cannot create socket" << std::endl;
+		return 1;
+	}
+
+	unlink(path.c_str());
+	if (bind(server, (sockaddr *)&address, sizeof(address)) < 0 || listen(server, 64) < 0)
+	{
+		std::cerr << "Cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+		close(server);
+		return 1;
+	}
+	std::cerr << "Listening on " << path << std::endl;
+
+	std::signal(SIGINT, request_stop);
+	std::signal(SIGTERM, request_stop);
+
+	std::vector<Client> clients;
+	auto reap = [&](bool all) {
+		for (auto it = clients.begin(); it != clients.end();)
+		{
+			if (all)
+			{
+				it->connection->shutdown();
+			}
+			if (all || *it->done)
+			{
+				it->reader.join();
+				it = clients.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	};
+
+	// The signal may land on any thread, so poll with a timeout rather
+	// than rely on it interrupting accept.
+	while (!stop_requested)
+	{
+		pollfd ready = {server, POLLIN, 0};
+		if (poll(&ready, 1, 250) <= 0)
+		{
+			continue;
+		}
+
+		int fd = accept(server, nullptr, nullptr);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		reap(false);
+		Client client;
+		client.connection = std::make_shared<Connection>(fd, true);
+		client.done = std::make_shared<std::atomic<bool>>(false);
+		client.reader = std::thread(
+			[fd, &queue](std::shared_ptr<Connection> connection, std::shared_ptr<std::atomic<bool>> done) {
+				read_queries(fd, connection, queue);
+				*done = true;
+			},
+			client.connection, client.done);
+		clients.push_back(std::move(client));
+	}
+
+	std::cerr << "Stopping" << std::endl;
+	close(server);
+	unlink(path.c_str());
+	reap(true);
+	return 0;
+}
+
+// The worker threads serving a QueryQueue. The queue is closed and the
+// workers joined when the pool goes out of scope, on every exit path, so
+// queries already queued are answered first.
+class WorkerPool
+{
+	//
+public:
+	//
+	WorkerPool(const Catalog &catalog, QueryQueue &queue, unsigned workers, size_t batch_size)
+		: _queue(queue)
+	{
+		try
+		{
+			for (unsigned w = 0; w < workers; w++)
+			{
+				_threads.emplace_back(serve, std::cref(catalog), std::ref(queue), batch_size);
+			}
+		}
+		catch (...)
+		{
+			stop();
+			throw;
+		}
+	}
+
+	~WorkerPool() { stop(); }
+
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool &operator=(const WorkerPool &) = delete;
+
+	//
+private:
+	void stop()
+	{
+		_queue.close();
+		for (auto &thread : _threads)
+		{
+			thread.join();
+		}
+		_threads.clear();
+	}
+
+	QueryQueue &_queue;
+	std::vector<std::thread> _threads;
+};
+
+int main(int argc, char *argv[])
+{
+	std::string catalog_path = "armor.csv", socket_path;
+	unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+	size_t batch_size = 64;
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		std::string flag = argv[i], value = argv[i + 1];
+		if (flag == "--catalog")
+		{
+			catalog_path = value;
+		}
+		else if (flag == "--socket")
+		{
+			socket_path = value;
+		}
+		else if (flag == "--workers")
+		{
+			workers = std::max(1, std::stoi(value));
+		}
+		else if (flag == "--batch")
+		{
+			batch_size = std::max(1, std::stoi(value));
+		}
+		else
+		{
+			std::cerr << "Unknown option: " << flag << std::endl;
+			return 1;
+		}
+	}
+
+	// A client that hangs up should not take the service down.
+	std::signal(SIGPIPE, SIG_IGN);
+
+	Timer load_timer;
+	Catalog catalog;
+	catalog.armors = load_armor_database(catalog_path);
+	if (!catalog.armors)
+	{
+		return 1;
+	}
+	catalog.greedy.reset(new GreedyIndex(*catalog.armors));
+	std::cerr
+		<< "Loaded " << catalog.armors->size() << " armors in "
+		<< load_timer.elapsed() << " s; " << workers << " workers" << std::endl;
+
+	QueryQueue queue;
+	WorkerPool pool(catalog, queue, workers, batch_size);
+
+	if (!socket_path.empty())
+	{
+		return listen_on_socket(socket_path, queue);
+	}
+
+	read_queries(STDIN_FILENO, std::make_shared<Connection>(STDOUT_FILENO, false), queue);
+	return 0;
+}
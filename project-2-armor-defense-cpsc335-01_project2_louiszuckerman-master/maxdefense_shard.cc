@@ -0,0 +1,243 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxdefense_shard.cc
+//
+// Sharded exhaustive search: split the subsets of the first n armors of the
+// catalog into shards, solve each shard in its own process, and merge the
+// shard records. Workers only share a directory, so the same binary can fan
+// out over local processes ("run"), or over hosts by starting "worker" on
+// each of them by hand and calling "merge" on the result files.
+//
+// Usage:
+//	shard run <csv> <n> <budget> <workers> <dir>
+//	shard worker <csv> <n> <budget> <first> <last> <output>
+//	shard merge <csv> <n> <budget> <record>...
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "maxdefense.hh"
+#include "timer.hh"
+
+
+// The same first n armors every other experiment uses.
+// Returns nullptr if the catalog cannot be read or has fewer than n of them.
+std::unique_ptr<ArmorVector> load_instance(const std::string &path, int n)
+{
+	if (n < 0 || n >= 64)
+	{
+		std::cout << "n must be in [0, 64): " << n << std::endl;
+		return nullptr;
+	}
+
+	auto all_armors = load_armor_database(path);
+	if (!all_armors)
+	{
+		return nullptr;
+	}
+
+	auto armors = filter_armor_vector(*all_armors, 1, 2500, n);
+	if (int(armors->size()) != n)
+	{
+		std::cout << "Catalog has only " << armors->size() << " armors, need " << n << std::endl;
+		return nullptr;
+	}
+	return armors;
+}
+
+// The budget as a hex float, so every worker parses back exactly the
+// budget the coordinator was given.
+std::string format_budget(double budget)
+{
+	char text[64];
+	std::snprintf(text, sizeof(text), "%a", budget);
+	return text;
+}
+
+// Solve one shard and write its record to output.
+// The record is written to a temporary file first and renamed into place,
+// so a reader on a shared filesystem never sees half of it.
+int run_worker(const std::string &path, int n, double budget, uint64_t first, uint64_t last, const std::string &output)
+{
+	auto armors = load_instance(path, n);
+	if (!armors)
+	{
+		return 1;
+	}
+	if (first > last || last > (uint64_t(1) << n))
+	{
+		std::cout << "Shard [" << first << ", " << last << ") is not inside [0, 2^" << n << ")" << std::endl;
+		return 1;
+	}
+
+	ShardRecord record;
+	record.n = n;
+	record.total_cost = budget;
+	record.first = first;
+	record.last = last;
+	record.best = exhaustive_max_defense_shard(*armors, budget, first, last);
+
+	std::string partial = output + ".partial";
+	{
+		std::ofstream f(partial);
+		f << format_shard_result(record) << std::endl;
+		if (!f)
+		{
+			std::cout << "Failed to write shard record: " << partial << std::endl;
+			return 1;
+		}
+	}
+	if (std::rename(partial.c_str(), output.c_str()) != 0)
+	{
+		std::cout << "Failed to write shard record: " << output << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Merge shard records and print the winning selection.
+// Fails unless the records are all for this n and budget and together cover
+// every subset exactly once.
+int run_merge(const std::string &path, int n, double budget, const std::vector<std::string> &records)
+{
+	auto armors = load_instance(path, n);
+	if (!armors)
+	{
+		return 1;
+	}
+
+	std::vector<ShardRecord> shards;
+	for (auto &record : records)
+	{
+		std::ifstream f(record);
+		std::string line;
+		ShardRecord shard;
+		if (!std::getline(f, line) || !parse_shard_result(line, shard))
+		{
+			std::cout << "Failed to read shard record: " << record << std::endl;
+			return 1;
+		}
+		shards.push_back(shard);
+	}
+
+	ExhaustiveBest best;
+	std::string error;
+	if (!merge_shard_records(shards, n, budget, best, error))
+	{
+		std::cout << "Shard records do not cover the search: " << error << std::endl;
+		return 1;
+	}
+
+	print_armor_vector(*armor_vector_from_mask(*armors, best.mask));
+	return 0;
+}
+
+// Launch one worker process per shard, wait for all of them, then merge.
+int run_coordinator(const char *self, const std::string &path, int n, double budget, int workers, const std::string &dir)
+{
+	if (!load_instance(path, n))
+	{
+		return 1;
+	}
+	if (workers < 1)
+	{
+		std::cout << "Need at least one worker" << std::endl;
+		return 1;
+	}
+
+	const uint64_t total = uint64_t(1) << n;
+	std::vector<std::string> records;
+	std::vector<pid_t> children;
+
+	Timer timer;
+	for (int w = 0; w < workers; w++)
+	{
+		uint64_t first = total / workers * w + std::min<uint64_t>(w, total % workers);
+		uint64_t last = total / workers * (w + 1) + std::min<uint64_t>(w + 1, total % workers);
+		records.push_back(dir + "/shard-" + std::to_string(w) + ".txt");
+
+		std::vector<std::string> args = {
+			self, "worker", path, std::to_string(n), format_budget(budget),
+			std::to_string(first), std::to_string(last), records.back()};
+
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			// Do not leave the workers already started running unwatched.
+			std::cout << "Failed to start worker " << w << std::endl;
+			for (pid_t child : children)
+			{
+				kill(child, SIGTERM);
+				waitpid(child, nullptr, 0);
+			}
+			return 1;
+		}
+		if (pid == 0)
+		{
+			std::vector<char *> argv;
+			for (auto &arg : args)
+			{
+				argv.push_back(&arg[0]);
+			}
+			argv.push_back(nullptr);
+			// argv[0] has no directory when started through PATH, so run
+			// this same executable through /proc, or else search PATH.
+			execv("/proc/self/exe", argv.data());
+			execvp(self, argv.data());
+			_exit(127);
+		}
+		children.push_back(pid);
+	}
+
+	bool failed = false;
+	for (pid_t pid : children)
+	{
+		int status;
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			failed = true;
+		}
+	}
+	if (failed)
+	{
+		std::cout << "A worker failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "Exhaustive n: " << n << " Workers: " << workers << " Time: " << timer.elapsed() << std::endl;
+	return run_merge(path, n, budget, records);
+}
+
+int main(int argc, char *argv[])
+{
+	std::string mode = argc > 1 ? argv[1] : "";
+
+	if (mode == "run" && argc == 7)
+	{
+		return run_coordinator(argv[0], argv[2], std::stoi(argv[3]), std::stod(argv[4]), std::stoi(argv[5]), argv[6]);
+	}
+	else if (mode == "worker" && argc == 8)
+	{
+		return run_worker(argv[2], std::stoi(argv[3]), std::stod(argv[4]), std::stoull(argv[5]), std::stoull(argv[6]), argv[7]);
+	}
+	else if (mode == "merge" && argc >= 6)
+	{
+		return run_merge(argv[2], std::stoi(argv[3]), std::stod(argv[4]), std::vector<std::string>(argv + 5, argv + argc));
+	}
+
+	std::cout
+		<< "Usage:" << std::endl
+		<< "  shard run <csv> <n> <budget> <workers> <dir>" << std::endl
+		<< "  shard worker <csv> <n> <budget> <first> <last> <output>" << std::endl
+		<< "  shard merge <csv> <n> <budget> <record>..." << std::endl;
+	return 1;
+}
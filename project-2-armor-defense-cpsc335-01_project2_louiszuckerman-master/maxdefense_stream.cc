@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+// maxdefense_stream.cc
+//
+// Streaming greedy over an armor database read from a file or a pipe, in
+// bounded memory.
+//
+// Usage: stream [--budget B] [--min-defense D] [--max-defense D] [--limit N]
+//               [--memory-mb M] [path|-]
+//
+// With no path, or "-", the database is read from standard input, e.g.
+//
+//	./armorgen --rows 100000000 | ./stream --budget 5000 --memory-mb 16
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "maxdefense.hh"
+#include "timer.hh"
+
+
+int main(int argc, char *argv[])
+{
+	double budget = 5000;
+	double memory_mb = 64;
+	StreamFilter filter;
+	std::string path = "-";
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string flag = argv[i];
+		if (flag.compare(0, 2, "--") != 0)
+		{
+			path = flag;
+			continue;
+		}
+		if (i + 1 == argc)
+		{
+			std::cerr << "Missing value for " << flag << std::endl;
+			return 1;
+		}
+
+		std::string value = argv[++i];
+		if (flag == "--budget")
+		{
+			budget = std::stod(value);
+		}
+		else if (flag == "--min-defense")
+		{
+			filter.min_defense = std::stod(value);
+		}
+		else if (flag == "--max-defense")
+		{
+			filter.max_defense = std::stod(value);
+		}
+		else if (flag == "--limit")
+		{
+			filter.total_size = std::stoull(value);
+		}
+		else if (flag == "--memory-mb")
+		{
+			memory_mb = std::stod(value);
+		}
+		else
+		{
+			std::cerr << "Unknown option: " << flag << std::endl;
+			return 1;
+		}
+	}
+
+	std::ifstream file;
+	if (path != "-")
+	{
+		file.open(path);
+		if (!file)
+		{
+			std::cerr << "Cannot open " << path << std::endl;
+			return 1;
+		}
+	}
+	std::istream &input = path == "-" ? std::cin : file;
+
+	Timer timer;
+	StreamSelection selection;
+	StreamStats stats;
+	if (!stream_greedy_max_defense(input, filter, budget, size_t(memory_mb * 1024 * 1024), selection, &stats))
+	{
+		std::cerr << "Empty armor database" << std::endl;
+		return 1;
+	}
+
+	for (auto &armor : selection.items)
+	{
+		std::cout << armor.line << "^" << armor.description << "^" << armor.cost << "^" << armor.defense << std::endl;
+	}
+	std::cout
+		<< "total cost " << selection.total_cost
+		<< ", total defense " << selection.total_defense
+		<< (selection.exact ? "" : " (approximate: the memory limit dropped armor that could have fit)")
+		<< std::endl;
+
+	std::cerr
+		<< stats.rows << " rows, " << stats.invalid << " invalid, "
+		<< stats.accepted << " accepted, " << stats.kept << " kept, "
+		<< stats.dropped << " dropped, peak " << stats.peak_bytes << " bytes, "
+		<< timer.elapsed() << " s" << std::endl;
+	return 0;
+}
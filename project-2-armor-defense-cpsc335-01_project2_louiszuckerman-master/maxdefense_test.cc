@@ -7,9 +7,13 @@
 
 
 #include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <sstream>
 
 
+#include "armor_generator.hh"
 #include "maxdefense.hh"
 #include "rubrictest.hh"
 
@@ -125,6 +129,53 @@ int main()
 		}
 	);
 	
+	//
+	rubric.criterion(
+		"GreedyIndex matches greedy_max_defense", 2,
+		[&]()
+		{
+			GreedyIndex index(*filtered_armors);
+			
+			std::vector<double> budgets;
+			for (double budget = 0; budget <= 20000; budget += 137.5)
+			{
+				budgets.push_back(budget);
+			}
+			budgets.push_back(500);
+			budgets.push_back(5000);
+			
+			auto batch = index.query_batch(budgets);
+			TEST_EQUAL("one answer per budget", budgets.size(), batch.answers.size());
+			
+			for (size_t i = 0; i < budgets.size(); i++)
+			{
+				auto expected = greedy_max_defense(*filtered_armors, budgets[i]);
+				auto actual = index.materialize(batch, i);
+				TEST_EQUAL("same selection", *expected, *actual);
+				
+				double expected_cost, expected_defense;
+				sum_armor_vector(*expected, expected_cost, expected_defense);
+				TEST_EQUAL("same cost", std::round(expected_cost * 100), std::round(batch.answers[i].total_cost * 100));
+				TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(batch.answers[i].total_defense * 100));
+			}
+			
+			std::vector<GreedyRange> ranges;
+			double cost, defense;
+			index.query(10, ranges, cost, defense);
+			TEST_TRUE("nothing affordable", ranges.empty());
+			TEST_EQUAL("nothing affordable", 0, cost);
+			
+			// The index outlives the vector it was built from.
+			std::unique_ptr<GreedyIndex> owned;
+			{
+				ArmorVector copy(*filtered_armors);
+				owned.reset(new GreedyIndex(copy));
+			}
+			auto owned_batch = owned->query_batch({5000});
+			TEST_EQUAL("independent of the source vector", *greedy_max_defense(*filtered_armors, 5000), *owned->materialize(owned_batch, 0));
+		}
+	);
+	
 	//
 	rubric.criterion(
 		"exhaustive_max_defense trivial cases", 2,
@@ -202,6 +253,690 @@ int main()
 		}
 	);
 
+	//
+	rubric.criterion(
+		"exhaustive_max_defense_parallel matches sequential", 2,
+		[&]()
+		{
+			std::unique_ptr<ArmorVector> soln;
+			
+			soln = exhaustive_max_defense_parallel(trivial_armors, 150, 4);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("helmet and boots", 2, soln->size());
+			
+			for (int n = 1; n <= 20; n++)
+			{
+				auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, n);
+				auto expected = exhaustive_max_defense(*small_armors, 2000);
+				
+				for (unsigned threads : {1, 3, 8})
+				{
+					auto actual = exhaustive_max_defense_parallel(*small_armors, 2000, threads);
+					TEST_TRUE("non-null", actual);
+					TEST_EQUAL("same selection", *expected, *actual);
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"mitm_max_defense matches exhaustive", 2,
+		[&]()
+		{
+			std::unique_ptr<ArmorVector> soln;
+			
+			soln = mitm_max_defense(trivial_armors, 10);
+			TEST_TRUE("non-null", soln);
+			TEST_TRUE("empty solution", soln->empty());
+			
+			soln = mitm_max_defense(trivial_armors, 99);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("boots only", 1, soln->size());
+			TEST_EQUAL("boots only", "test boots", (*soln)[0]->description());
+			
+			soln = mitm_max_defense(trivial_armors, 150);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("helmet and boots", 2, soln->size());
+			
+			for (int n = 1; n <= 20; n++)
+			{
+				auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, n);
+				for (double budget : {500.0, 2000.0, 5000.0})
+				{
+					auto expected = exhaustive_max_defense(*small_armors, budget);
+					auto actual = mitm_max_defense(*small_armors, budget);
+					TEST_TRUE("non-null", actual);
+					
+					double expected_cost, expected_defense, actual_cost, actual_defense;
+					sum_armor_vector(*expected, expected_cost, expected_defense);
+					sum_armor_vector(*actual, actual_cost, actual_defense);
+					TEST_LE("within budget", actual_cost, budget);
+					TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(actual_defense * 100));
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"branch_and_bound_max_defense correctness", 2,
+		[&]()
+		{
+			std::unique_ptr<ArmorVector> soln;
+			
+			soln = branch_and_bound_max_defense(trivial_armors, 10);
+			TEST_TRUE("non-null", soln);
+			TEST_TRUE("empty solution", soln->empty());
+			
+			soln = branch_and_bound_max_defense(trivial_armors, 99);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("boots only", 1, soln->size());
+			TEST_EQUAL("boots only", "test boots", (*soln)[0]->description());
+			
+			soln = branch_and_bound_max_defense(trivial_armors, 150);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("helmet and boots", 2, soln->size());
+			TEST_EQUAL("helmet and boots", "test helmet", (*soln)[0]->description());
+			TEST_EQUAL("helmet and boots", "test boots", (*soln)[1]->description());
+			
+			for (int n = 1; n <= 40; n += 3)
+			{
+				auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, n);
+				for (double budget : {500.0, 2000.0, 5000.0})
+				{
+					auto expected = mitm_max_defense(*small_armors, budget);
+					auto actual = branch_and_bound_max_defense(*small_armors, budget);
+					TEST_TRUE("non-null", actual);
+					
+					double expected_cost, expected_defense, actual_cost, actual_defense;
+					sum_armor_vector(*expected, expected_cost, expected_defense);
+					sum_armor_vector(*actual, actual_cost, actual_defense);
+					TEST_LE("within budget", actual_cost, budget);
+					TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(actual_defense * 100));
+				}
+			}
+			
+			SearchStats stats;
+			soln = branch_and_bound_max_defense(*filtered_armors, 5000, &stats);
+			TEST_TRUE("non-null", soln);
+			TEST_GT("nodes explored", stats.nodes_explored, 0);
+			
+			double cost, defense;
+			sum_armor_vector(*soln, cost, defense);
+			cost	= std::round( cost	* 100 ) / 100;
+			defense	= std::round( defense	* 100 ) / 100;
+			TEST_LE("within budget", cost, 5000);
+			TEST_EQUAL("full catalog defense", 9219.89, defense);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"fptas_max_defense within epsilon of optimal", 2,
+		[&]()
+		{
+			std::unique_ptr<ArmorVector> soln;
+			
+			soln = fptas_max_defense(trivial_armors, 10, 0.1);
+			TEST_TRUE("non-null", soln);
+			TEST_TRUE("empty solution", soln->empty());
+			
+			soln = fptas_max_defense(trivial_armors, 99, 0.1);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("boots only", 1, soln->size());
+			TEST_EQUAL("boots only", "test boots", (*soln)[0]->description());
+			
+			soln = fptas_max_defense(trivial_armors, 150, 0.1);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("helmet and boots", 2, soln->size());
+			
+			auto some_armors = filter_armor_vector(*filtered_armors, 1, 2500, 500);
+			for (double budget : {500.0, 2000.0, 5000.0})
+			{
+				auto exact = branch_and_bound_max_defense(*some_armors, budget);
+				double exact_cost, exact_defense;
+				sum_armor_vector(*exact, exact_cost, exact_defense);
+				
+				for (double epsilon : {0.5, 0.1})
+				{
+					auto approximate = fptas_max_defense(*some_armors, budget, epsilon);
+					TEST_TRUE("non-null", approximate);
+					
+					double cost, defense;
+					sum_armor_vector(*approximate, cost, defense);
+					TEST_LE("within budget", cost, budget);
+					TEST_GE("within epsilon", defense, (1 - epsilon) * exact_defense);
+					TEST_LE("not above optimal", std::round(defense * 100), std::round(exact_defense * 100));
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"prune_armor_vector keeps the optimum", 2,
+		[&]()
+		{
+			PruneStats stats;
+			auto pruned = prune_armor_vector(trivial_armors, 99, &stats);
+			TEST_TRUE("non-null", pruned);
+			TEST_EQUAL("helmet over budget", 1, stats.over_budget);
+			TEST_EQUAL("boots kept", 1, pruned->size());
+			TEST_EQUAL("boots kept", "test boots", (*pruned)[0]->description());
+			
+			for (int n = 1; n <= 20; n++)
+			{
+				auto small_armors = filter_armor_vector(*all_armors, 0, 2500, n);
+				for (double budget : {500.0, 2000.0})
+				{
+					auto expected = exhaustive_max_defense(*small_armors, budget);
+					auto actual = exhaustive_max_defense(*prune_armor_vector(*small_armors, budget), budget);
+					
+					double expected_cost, expected_defense, actual_cost, actual_defense;
+					sum_armor_vector(*expected, expected_cost, expected_defense);
+					sum_armor_vector(*actual, actual_cost, actual_defense);
+					TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(actual_defense * 100));
+				}
+			}
+			
+			for (double budget : {500.0, 5000.0})
+			{
+				pruned = prune_armor_vector(*all_armors, budget, &stats);
+				TEST_EQUAL("counters add up", stats.input, stats.over_budget + stats.no_defense + stats.dominated + stats.output);
+				TEST_EQUAL("output size", pruned->size(), stats.output);
+				TEST_LT("input shrank", stats.output, stats.input);
+				
+				auto expected = branch_and_bound_max_defense(*all_armors, budget);
+				auto actual = branch_and_bound_max_defense(*pruned, budget);
+				
+				double expected_cost, expected_defense, actual_cost, actual_defense;
+				sum_armor_vector(*expected, expected_cost, expected_defense);
+				sum_armor_vector(*actual, actual_cost, actual_defense);
+				TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(actual_defense * 100));
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"dfs_max_defense matches exhaustive", 2,
+		[&]()
+		{
+			std::unique_ptr<ArmorVector> soln;
+			
+			soln = dfs_max_defense(trivial_armors, 10);
+			TEST_TRUE("non-null", soln);
+			TEST_TRUE("empty solution", soln->empty());
+			
+			soln = dfs_max_defense(trivial_armors, 99);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("boots only", 1, soln->size());
+			TEST_EQUAL("boots only", "test boots", (*soln)[0]->description());
+			
+			soln = dfs_max_defense(trivial_armors, 150);
+			TEST_TRUE("non-null", soln);
+			TEST_EQUAL("helmet and boots", 2, soln->size());
+			TEST_EQUAL("helmet and boots", "test helmet", (*soln)[0]->description());
+			TEST_EQUAL("helmet and boots", "test boots", (*soln)[1]->description());
+			
+			for (int n = 1; n <= 20; n++)
+			{
+				auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, n);
+				for (double budget : {500.0, 2000.0, 5000.0})
+				{
+					auto expected = exhaustive_max_defense(*small_armors, budget);
+					
+					SearchStats stats;
+					auto actual = dfs_max_defense(*small_armors, budget, &stats);
+					TEST_TRUE("non-null", actual);
+					TEST_LE("fewer nodes than subsets", stats.nodes_explored, size_t(1) << n);
+					
+					double expected_cost, expected_defense, actual_cost, actual_defense;
+					sum_armor_vector(*expected, expected_cost, expected_defense);
+					sum_armor_vector(*actual, actual_cost, actual_defense);
+					TEST_LE("within budget", actual_cost, budget);
+					TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(actual_defense * 100));
+				}
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"exhaustive_max_defense_shard records merge to the optimum", 2,
+		[&]()
+		{
+			auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, 16);
+			auto expected = exhaustive_max_defense(*small_armors, 2000);
+			
+			const int n = small_armors->size();
+			const uint64_t total = uint64_t(1) << n;
+			std::vector<ShardRecord> records;
+			for (uint64_t first = 0; first < total; first += 10000)
+			{
+				ShardRecord shard;
+				shard.n = n;
+				shard.total_cost = 2000;
+				shard.first = first;
+				shard.last = std::min(total, first + 10000);
+				shard.best = exhaustive_max_defense_shard(*small_armors, 2000, shard.first, shard.last);
+				
+				ShardRecord parsed;
+				TEST_TRUE("record parses", parse_shard_result(format_shard_result(shard), parsed));
+				TEST_EQUAL("round trip n", shard.n, parsed.n);
+				TEST_EQUAL("round trip budget", shard.total_cost, parsed.total_cost);
+				TEST_EQUAL("round trip first", shard.first, parsed.first);
+				TEST_EQUAL("round trip last", shard.last, parsed.last);
+				TEST_EQUAL("round trip found", shard.best.found, parsed.best.found);
+				TEST_EQUAL("round trip mask", shard.best.mask, parsed.best.mask);
+				TEST_EQUAL("round trip cost", shard.best.cost, parsed.best.cost);
+				TEST_EQUAL("round trip defense", shard.best.defense, parsed.best.defense);
+				
+				records.push_back(parsed);
+			}
+			
+			ExhaustiveBest merged;
+			std::string error;
+			std::reverse(records.begin(), records.end());
+			TEST_TRUE("records tile the search", merge_shard_records(records, n, 2000, merged, error));
+			TEST_TRUE("found", merged.found);
+			TEST_EQUAL("same selection", *expected, *armor_vector_from_mask(*small_armors, merged.mask));
+			
+			auto missing = records;
+			missing.erase(missing.begin() + 1);
+			TEST_FALSE("missing shard rejected", merge_shard_records(missing, n, 2000, merged, error));
+			auto duplicated = records;
+			duplicated.push_back(records[1]);
+			TEST_FALSE("duplicate shard rejected", merge_shard_records(duplicated, n, 2000, merged, error));
+			auto overlapping = records;
+			overlapping[1].last += 1;
+			TEST_FALSE("overlapping shard rejected", merge_shard_records(overlapping, n, 2000, merged, error));
+			TEST_FALSE("other budget rejected", merge_shard_records(records, n, 2001, merged, error));
+			TEST_FALSE("other n rejected", merge_shard_records(records, n + 1, 2000, merged, error));
+			
+			ShardRecord invalid;
+			TEST_FALSE("garbage rejected", parse_shard_result("found 1 mask", invalid));
+		}
+	);
+
+	//
+	rubric.criterion(
+		"ArmorSelection results agree with the original solvers", 2,
+		[&]()
+		{
+			auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, 16);
+			
+			// The original greedy loop: take the best remaining ratio, the
+			// first one on a tie, whenever it still fits.
+			auto baseline_greedy = [](const ArmorVector &armors, double total_cost)
+			{
+				std::vector<size_t> order(armors.size()), indices;
+				for (size_t i = 0; i < order.size(); i++)
+				{
+					order[i] = i;
+				}
+				std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+				{
+					return armors[a]->defense() / armors[a]->cost() > armors[b]->defense() / armors[b]->cost();
+				});
+				double spent = 0;
+				for (size_t i : order)
+				{
+					if (armors[i]->cost() + spent <= total_cost)
+					{
+						indices.push_back(i);
+						spent += armors[i]->cost();
+					}
+				}
+				return indices;
+			};
+			
+			// The original exhaustive loop: every mask in counting order,
+			// summed in catalog order, the first best one kept.
+			auto baseline_exhaustive = [](const ArmorVector &armors, double total_cost)
+			{
+				bool found = false;
+				uint64_t best_mask = 0;
+				double best_defense = 0;
+				for (uint64_t mask = 0; mask < (uint64_t(1) << armors.size()); mask++)
+				{
+					double cost = 0, defense = 0;
+					for (size_t j = 0; j < armors.size(); j++)
+					{
+						if ((mask >> j) & 1)
+						{
+							cost += armors[j]->cost();
+							defense += armors[j]->defense();
+						}
+					}
+					if (cost <= total_cost && (!found || defense > best_defense))
+					{
+						found = true;
+						best_mask = mask;
+						best_defense = defense;
+					}
+				}
+				std::vector<size_t> indices;
+				for (size_t j = 0; j < armors.size(); j++)
+				{
+					if ((best_mask >> j) & 1)
+					{
+						indices.push_back(j);
+					}
+				}
+				return indices;
+			};
+			
+			auto check = [&](const ArmorVector &armors, const ArmorSelection &selection, const std::vector<size_t> &expected)
+			{
+				TEST_EQUAL("same indices as the original", expected, selection.indices);
+				
+				double cost, defense;
+				sum_armor_vector(*materialize_selection(armors, selection), cost, defense);
+				TEST_EQUAL("same cost", std::round(cost * 100), std::round(selection.total_cost * 100));
+				TEST_EQUAL("same defense", std::round(defense * 100), std::round(selection.total_defense * 100));
+			};
+			
+			const std::vector<size_t> optimal = baseline_exhaustive(*small_armors, 2000);
+			check(*filtered_armors, greedy_max_defense_selection(*filtered_armors, 5000), baseline_greedy(*filtered_armors, 5000));
+			check(*small_armors, exhaustive_max_defense_selection(*small_armors, 2000), optimal);
+			check(*small_armors, exhaustive_max_defense_parallel_selection(*small_armors, 2000, 2), optimal);
+			check(*small_armors, mitm_max_defense_selection(*small_armors, 2000), optimal);
+			check(*small_armors, dfs_max_defense_selection(*small_armors, 2000), optimal);
+			check(*small_armors, branch_and_bound_max_defense_selection(*small_armors, 2000), optimal);
+			
+			double optimal_cost, optimal_defense;
+			sum_armor_vector(*materialize_selection(*small_armors, exhaustive_max_defense_selection(*small_armors, 2000)), optimal_cost, optimal_defense);
+			ArmorSelection approximate = fptas_max_defense_selection(*small_armors, 2000, 0.5);
+			TEST_LE("fptas within budget", approximate.total_cost, 2000);
+			TEST_GE("fptas within epsilon", approximate.total_defense, 0.5 * optimal_defense);
+			TEST_TRUE("fptas indices valid", std::is_sorted(approximate.indices.begin(), approximate.indices.end())
+				&& (approximate.indices.empty() || approximate.indices.back() < small_armors->size()));
+			
+			ArmorSelection empty = exhaustive_max_defense_selection(trivial_armors, 10);
+			TEST_TRUE("empty selection", empty.indices.empty());
+			TEST_EQUAL("empty selection", 0, empty.total_defense);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"armor_generator is deterministic and loadable", 2,
+		[&]()
+		{
+			ArmorGeneratorOptions options;
+			options.rows = 5000;
+			options.seed = 7;
+			
+			std::stringstream first, second;
+			write_armor_csv(first, options);
+			write_armor_csv(second, options);
+			TEST_EQUAL("same seed, same catalog", first.str(), second.str());
+			
+			options.seed = 8;
+			std::stringstream other;
+			write_armor_csv(other, options);
+			TEST_NOT_EQUAL("other seed, other catalog", first.str(), other.str());
+			
+			const std::string path = "armor_generator_test.csv";
+			{
+				std::ofstream f(path);
+				f << first.str();
+			}
+			auto loaded = load_armor_database(path);
+			std::remove(path.c_str());
+			TEST_TRUE("non-null", loaded);
+			TEST_EQUAL("size", 5000, loaded->size());
+			
+			options.seed = 7;
+			auto generated = generate_armor_vector(options);
+			TEST_EQUAL("size", 5000, generated->size());
+			for (size_t i = 0; i < generated->size(); i++)
+			{
+				TEST_EQUAL("same description", (*loaded)[i]->description(), (*generated)[i]->description());
+				TEST_EQUAL("same cost", (*loaded)[i]->cost(), (*generated)[i]->cost());
+				TEST_EQUAL("same defense", (*loaded)[i]->defense(), (*generated)[i]->defense());
+				TEST_GT("positive cost", (*generated)[i]->cost(), 0);
+			}
+			
+			std::vector<double> costs, defenses;
+			generate_armor_columns(options, costs, defenses);
+			TEST_EQUAL("columns", 5000, costs.size());
+			TEST_EQUAL("columns", (*generated)[4999]->cost(), costs[4999]);
+			TEST_EQUAL("columns", (*generated)[4999]->defense(), defenses[4999]);
+			
+			// Positive correlation shows up in the sample.
+			options.correlation = 0.9;
+			generate_armor_columns(options, costs, defenses);
+			double mean_cost = 0, mean_defense = 0;
+			for (size_t i = 0; i < costs.size(); i++)
+			{
+				mean_cost += costs[i] / costs.size();
+				mean_defense += defenses[i] / costs.size();
+			}
+			double covariance = 0;
+			for (size_t i = 0; i < costs.size(); i++)
+			{
+				covariance += (costs[i] - mean_cost) * (defenses[i] - mean_defense);
+			}
+			TEST_GT("correlated", covariance, 0);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"ProfileScope records nested regions", 2,
+		[&]()
+		{
+			ThreadProfile::current().flush();
+			ProfileRegistry::instance().clear();
+			
+			for (int i = 0; i < 3; i++)
+			{
+				ProfileScope outer("outer");
+				for (int j = 0; j < 2; j++)
+				{
+					ProfileScope inner("inner");
+				}
+			}
+			ThreadProfile::current().flush();
+			
+			auto entries = ProfileRegistry::instance().entries();
+			TEST_EQUAL("two regions", 2, entries.size());
+			TEST_EQUAL("outer path", "outer", entries[0].path);
+			TEST_EQUAL("outer calls", 3, entries[0].calls);
+			TEST_EQUAL("inner path", "outer/inner", entries[1].path);
+			TEST_EQUAL("inner calls", 6, entries[1].calls);
+			TEST_LE("min <= mean", entries[1].min, entries[1].mean);
+			TEST_LE("mean <= max", entries[1].mean, entries[1].max);
+			TEST_LE("inner within outer", entries[1].total, entries[0].total);
+			
+			ProfileRegistry::instance().clear();
+		}
+	);
+
+	//
+	rubric.criterion(
+		"streaming greedy matches greedy_max_defense", 2,
+		[&]()
+		{
+			StreamSelection selection;
+			StreamStats stats;
+			
+			std::ifstream whole("armor.csv");
+			TEST_TRUE("streamed", stream_greedy_max_defense(whole, StreamFilter(), 500, SIZE_MAX, selection, &stats));
+			TEST_EQUAL("rows", all_armors->size(), stats.rows);
+			TEST_EQUAL("nothing dropped", 0, stats.dropped);
+			TEST_TRUE("exact", selection.exact);
+			
+			ArmorSelection expected = greedy_max_defense_selection(*all_armors, 500);
+			TEST_EQUAL("same count", expected.indices.size(), selection.items.size());
+			for (size_t k = 0; k < selection.items.size(); k++)
+			{
+				TEST_EQUAL("same items", expected.indices[k], selection.items[k].line);
+			}
+			
+			StreamFilter filter;
+			filter.min_defense = 100;
+			filter.max_defense = 500;
+			filter.total_size = 1000;
+			std::ifstream bounded("armor.csv");
+			TEST_TRUE("streamed", stream_greedy_max_defense(bounded, filter, 500, 8192, selection, &stats));
+			TEST_EQUAL("accepted", 1000, stats.accepted);
+			TEST_LE("memory ceiling, array capacity included", stats.peak_bytes, 8192);
+			TEST_LT("kept a few", stats.kept, 100);
+			TEST_TRUE("exact", selection.exact);
+			
+			auto filtered = filter_armor_vector(*all_armors, 100, 500, 1000);
+			expected = greedy_max_defense_selection(*filtered, 500);
+			TEST_EQUAL("same defense", std::round(expected.total_defense * 100), std::round(selection.total_defense * 100));
+			
+			// A long description is evicted first, which must not let a
+			// later, worse armor in ahead of it.
+			std::string mixed =
+				"Item^Cost^Defense\n"
+				"a^4^40\n" +
+				std::string(200, 'b') + "^5^5\n"
+				"c^6^3\n";
+			std::stringstream small_memory(mixed);
+			TEST_TRUE("streamed", stream_greedy_max_defense(small_memory, StreamFilter(), 10, 2 * (sizeof(StreamedArmor) + 15) + 10, selection, &stats));
+			TEST_EQUAL("worse armor dropped too", 1, stats.kept);
+			TEST_FALSE("the long armor could have fit", selection.exact);
+			
+			std::stringstream enough_memory(mixed);
+			TEST_TRUE("streamed", stream_greedy_max_defense(enough_memory, StreamFilter(), 10, SIZE_MAX, selection, &stats));
+			TEST_TRUE("exact", selection.exact);
+			TEST_EQUAL("full greedy", 45, selection.total_defense);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"fixed-point tables agree with the double solvers", 2,
+		[&]()
+		{
+			ArmorTable<int32_t> trivial = make_fixed_point_table(trivial_armors);
+			TEST_EQUAL("centi-gold", 10000, trivial.costs[0]);
+			TEST_EQUAL("centi-defense", 500, trivial.defenses[1]);
+			TEST_EQUAL("budget rounds down", 9999, trivial.budget(99.999));
+			TEST_EQUAL("budget", 48148, trivial.budget(481.48));
+			
+			auto small_armors = filter_armor_vector(*filtered_armors, 1, 2500, 16);
+			ArmorTable<int32_t> fixed = make_fixed_point_table(*small_armors);
+			for (double budget : {0.0, 500.0, 2000.0})
+			{
+				ArmorSelection expected = exhaustive_max_defense_selection(*small_armors, budget);
+				ArmorSelection actual = exhaustive_max_defense_table(fixed, budget);
+				TEST_EQUAL("exhaustive same items", expected.indices, actual.indices);
+				TEST_EQUAL("exhaustive same defense", std::round(expected.total_defense * 100), std::round(actual.total_defense * 100));
+			}
+			
+			fixed = make_fixed_point_table(*filtered_armors);
+			for (double budget : {500.0, 5000.0})
+			{
+				ArmorSelection expected = greedy_max_defense_selection(*filtered_armors, budget);
+				ArmorSelection actual = greedy_max_defense_table(fixed, budget);
+				TEST_EQUAL("greedy same defense", std::round(expected.total_defense * 100), std::round(actual.total_defense * 100));
+				TEST_LE("greedy within budget", actual.total_cost, budget);
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"batched exhaustive kernels match exhaustive_scan", 2,
+		[&]()
+		{
+			ArmorVector duplicates = trivial_armors;
+			duplicates.insert(duplicates.end(), trivial_armors.begin(), trivial_armors.end());
+			duplicates.insert(duplicates.end(), trivial_armors.begin(), trivial_armors.end());
+			
+			auto small_armors = filter_armor_vector(*filtered_armors, 1, 2500, 18);
+			
+			std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+			if (simd_level_supported() != SimdLevel::Scalar)
+			{
+				levels.push_back(SimdLevel::AVX2);
+			}
+			if (simd_level_supported() == SimdLevel::AVX512)
+			{
+				levels.push_back(SimdLevel::AVX512);
+			}
+			
+			for (const ArmorVector *armors : {&trivial_armors, &duplicates, small_armors.get()})
+			{
+				ArmorTable<int32_t> table = make_fixed_point_table(*armors);
+				for (double budget : {-1.0, 0.0, 40.0, 100.0, 180.0, 2000.0, 1e9})
+				{
+					auto expected = exhaustive_scan(table.costs, table.defenses, table.budget(budget), 0, uint64_t(1) << table.size());
+					for (SimdLevel level : levels)
+					{
+						auto actual = exhaustive_scan_batched(table, table.budget(budget), level);
+						TEST_EQUAL(simd_level_name(level), expected.found, actual.found);
+						TEST_EQUAL(simd_level_name(level), expected.mask, actual.mask);
+						TEST_EQUAL(simd_level_name(level), expected.cost, actual.cost);
+						TEST_EQUAL(simd_level_name(level), expected.defense, actual.defense);
+					}
+				}
+			}
+			
+			ArmorSelection expected = exhaustive_max_defense_selection(*small_armors, 2000);
+			ArmorSelection actual = exhaustive_max_defense_simd_selection(*small_armors, 2000);
+			TEST_EQUAL("drop-in", expected.indices, actual.indices);
+		}
+	);
+
+	//
+	rubric.criterion(
+		"exhaustive ties and exact-budget subsets match the counting loop", 2,
+		[&]()
+		{
+			// Tenths do not add up exactly in binary, so subsets that cost
+			// the budget or tie the best defense are decided by rounding.
+			const double prices[] = {0.1, 0.2, 0.3, 0.7, 1.1, 0.6};
+			ArmorVector armors;
+			for (int j = 0; j < 24; j++)
+			{
+				armors.push_back(std::shared_ptr<ArmorItem>(new ArmorItem("tenths", prices[(j * 2) % 6], (j * 7 + 1) % 5 + 1)));
+			}
+			
+			for (double budget : {0.3, 1.5})
+			{
+				// The counting loop's answer: sums taken in catalog order,
+				// ties to the smaller mask.
+				bool found = false;
+				uint64_t best_mask = 0;
+				double best_defense = 0;
+				std::function<void(size_t, uint64_t, double, double)> visit = [&](size_t j, uint64_t mask, double cost, double defense)
+				{
+					if (j == armors.size())
+					{
+						if (cost <= budget && (!found || defense > best_defense || (defense == best_defense && mask < best_mask)))
+						{
+							found = true;
+							best_mask = mask;
+							best_defense = defense;
+						}
+						return;
+					}
+					visit(j + 1, mask, cost, defense);
+					visit(j + 1, mask | (uint64_t(1) << j), cost + armors[j]->cost(), defense + armors[j]->defense());
+				};
+				visit(0, 0, 0, 0);
+				
+				ArmorSelection actual = exhaustive_max_defense_selection(armors, budget);
+				uint64_t actual_mask = 0;
+				for (size_t i : actual.indices)
+				{
+					actual_mask |= uint64_t(1) << i;
+				}
+				TEST_EQUAL("same subset as the counting loop", best_mask, actual_mask);
+				TEST_EQUAL("same subset in parallel", actual.indices, exhaustive_max_defense_parallel_selection(armors, budget, 3).indices);
+			}
+		}
+	);
+
 	return rubric.run();
 }
 
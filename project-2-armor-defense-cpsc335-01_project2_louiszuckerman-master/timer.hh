@@ -4,9 +4,9 @@
 // Timer class for code timing.
 //
 // This class depends only on the C++11 STL so it ought to be
-// portable. It uses the std::clock() function which is precise to
-// platform-dependent fractions of a second, as specified by
-// CLOCKS_PER_SEC.
+// portable. It uses std::chrono::steady_clock, which is monotonic, so
+// measurements are not disturbed when the system clock is adjusted.
+// For profiling many nested regions, see profile.hh.
 //
 // How to use:
 //
@@ -24,10 +24,6 @@
 #include <chrono>
 
 class Timer {
-  /*
-private:
-  typedef std::high_resolution_clock::time_point time;
-  */
 public:
   // Create a new Timer that is running as soon as it is created.
   Timer() {
@@ -36,18 +32,18 @@ public:
 
   // Reset the timer.
   void reset() {
-    _start = std::chrono::high_resolution_clock::now();
+    _start = std::chrono::steady_clock::now();
   }
 
   // Return the number of seconds since the timer was created, or the
   // last time it was reset.
   double elapsed() const {
-    auto end = std::chrono::high_resolution_clock::now();
+    auto end = std::chrono::steady_clock::now();
     assert(end >= _start);
     auto time_span = std::chrono::duration_cast<std::chrono::duration<double>>(end - _start);
     return time_span.count();
   }
 
  private:
-  std::chrono::high_resolution_clock::time_point _start;
+  std::chrono::steady_clock::time_point _start;
 };
@@ -8,17 +8,38 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip>
+#include <map>
 #include <memory>
+#include <numeric>
 #include <queue>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MAXDEFENSE_X86 1
+#endif
+
+#include "profile.hh"
+
 // One armor item available for purchase.
 class ArmorItem
 {
@@ -62,6 +83,8 @@ typedef std::vector<std::shared_ptr<ArmorItem>> ArmorVector;
 // Returns nullptr on I/O error.
 std::unique_ptr<ArmorVector> load_armor_database(const std::string &path)
 {
+	PROFILE_SCOPE("load_armor_database");
+
 	std::unique_ptr<ArmorVector> failure(nullptr);
 
 	std::ifstream f(path);
@@ -184,29 +207,98 @@ void print_armor_vector(const ArmorVector &armors)
 	}
 }
 
-// Convenience function to print out a 2D cache, composed of an std::vector<std::vector<double>>
+// A rows x columns table in a single allocation. Each row starts on a
+// 64-byte cache line: the stride is the column count rounded up to the
+// smallest number of elements that fills whole lines, for any sizeof(T),
+// so a row sweep streams through contiguous memory with no
+// indirection. With huge_pages the allocation is aligned to 2 MB and,
+// on Linux, advised for transparent huge pages, which cuts TLB misses on
+// tables of many megabytes.
+template <typename T>
+class Table2D
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Table2D holds plain values");
+
+	//
+public:
+	//
+	Table2D(size_t rows, size_t columns, bool huge_pages = false, T fill = T())
+		: _rows(rows),
+		  _columns(columns),
+		  _stride(round_up(columns, line_bytes / std::gcd(line_bytes, sizeof(T))))
+	{
+		const size_t alignment = huge_pages ? huge_page_bytes : line_bytes;
+		_bytes = round_up(std::max<size_t>(_rows * _stride * sizeof(T), 1), alignment);
+		_data = static_cast<T *>(std::aligned_alloc(alignment, _bytes));
+		if (!_data)
+		{
+			throw std::bad_alloc();
+		}
+#ifdef MADV_HUGEPAGE
+		if (huge_pages)
+		{
+			madvise(_data, _bytes, MADV_HUGEPAGE);
+		}
+#endif
+		std::fill_n(_data, _rows * _stride, fill);
+	}
+
+	~Table2D() { std::free(_data); }
+
+	Table2D(const Table2D &) = delete;
+	Table2D &operator=(const Table2D &) = delete;
+
+	T *row(size_t i) { return _data + i * _stride; }
+	const T *row(size_t i) const { return _data + i * _stride; }
+
+	T &operator()(size_t i, size_t j) { return row(i)[j]; }
+	const T &operator()(size_t i, size_t j) const { return row(i)[j]; }
+
+	size_t rows() const { return _rows; }
+	size_t columns() const { return _columns; }
+	size_t stride() const { return _stride; }
+	size_t bytes() const { return _bytes; }
+
+	//
+private:
+	static constexpr size_t line_bytes = 64;
+	static constexpr size_t huge_page_bytes = size_t(2) << 20;
+
+	static size_t round_up(size_t value, size_t multiple)
+	{
+		return (value + multiple - 1) / multiple * multiple;
+	}
+
+	size_t _rows;
+	size_t _columns;
+	size_t _stride;
+	size_t _bytes;
+	T *_data;
+};
+
+// Convenience function to print out a 2D cache, composed of a Table2D<double>
 // For sanity, will refuse to print a cache that is too large.
 // Hint: When running this program, you can redirect stdout to a file,
 //	which may be easier to view and inspect than a terminal
-void print_2d_cache(const std::vector<std::vector<double>> &cache)
+void print_2d_cache(const Table2D<double> &cache)
 {
 	std::cout << "*** 2D Cache ***" << std::endl;
 
-	if (cache.size() == 0)
+	if (cache.rows() == 0)
 	{
 		std::cout << "[empty]" << std::endl;
 	}
-	else if (cache.size() > 250 || cache[1].size() > 250)
+	else if (cache.rows() > 250 || cache.columns() > 250)
 	{
 		std::cout << "[too large]" << std::endl;
 	}
 	else
 	{
-		for (const std::vector<double> row : cache)
+		for (size_t i = 0; i < cache.rows(); i++)
 		{
-			for (double value : row)
+			for (size_t j = 0; j < cache.columns(); j++)
 			{
-				std::cout << std::setw(5) << value;
+				std::cout << std::setw(5) << cache(i, j);
 			}
 			std::cout << std::endl;
 		}
@@ -230,6 +322,8 @@ std::unique_ptr<ArmorVector> filter_armor_vector(
 	double max_defense,
 	int total_size)
 {
+	PROFILE_SCOPE("filter_armor_vector");
+
 	std::unique_ptr<ArmorVector> filtered_vector(new ArmorVector);
 	size_t i = 0;
 	size_t accepted_counter = 0;
@@ -260,64 +354,806 @@ std::unique_ptr<ArmorVector> filter_armor_vector(
 	return filtered_vector;
 }
 
+// Counters reported by prune_armor_vector: how many armor items came in,
+// why the removed ones were removed, and how many are left.
+struct PruneStats
+{
+	size_t input = 0;
+	size_t over_budget = 0;
+	size_t no_defense = 0;
+	size_t dominated = 0;
+	size_t output = 0;
+};
+
+// Create and return a new ArmorVector holding the armor items of source that
+// can matter to an optimal selection within total_cost, in their original
+// order. The optimal defense over the result is the same as over source, so
+// the result can be given to any of the solvers below instead of source.
+// An armor item is removed when:
+//	1) it costs more than total_cost, or
+//	2) its defense is zero or negative, or
+//	3) it is dominated beyond use: the armors that cost no more and defend at
+//	   least as much (ties broken by catalog order) are too expensive to all be
+//	   bought along with it. Any selection containing it then leaves out one
+//	   of them, which can be swapped in without losing defense.
+// Rule 3 is evaluated in O(n log n) by visiting armors from cheapest to most
+// expensive, keeping the cost of the armors seen so far in a Fenwick tree
+// indexed by defense rank. If stats is not null, the counters are stored there.
+std::unique_ptr<ArmorVector> prune_armor_vector(
+	const ArmorVector &source,
+	int total_cost,
+	PruneStats *stats = nullptr)
+{
+	PROFILE_SCOPE("prune_armor_vector");
+
+	PruneStats counters;
+	counters.input = source.size();
+
+	std::vector<size_t> candidates;
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		if (source[i]->cost() > total_cost)
+		{
+			counters.over_budget++;
+		}
+		else if (source[i]->defense() <= 0)
+		{
+			counters.no_defense++;
+		}
+		else
+		{
+			candidates.push_back(i);
+		}
+	}
+
+	// Cheapest first; among equal costs, strongest first; then catalog order.
+	// Every armor visited before another with at least its defense dominates it.
+	std::vector<size_t> order(candidates);
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		if (source[a]->cost() != source[b]->cost())
+		{
+			return source[a]->cost() < source[b]->cost();
+		}
+		if (source[a]->defense() != source[b]->defense())
+		{
+			return source[a]->defense() > source[b]->defense();
+		}
+		return a < b;
+	});
+
+	// Rank 0 is the highest defense, so a prefix of ranks is "at least this defense".
+	std::vector<double> defense_levels;
+	for (size_t i : candidates)
+	{
+		defense_levels.push_back(source[i]->defense());
+	}
+	std::sort(defense_levels.begin(), defense_levels.end(), std::greater<double>());
+	defense_levels.erase(std::unique(defense_levels.begin(), defense_levels.end()), defense_levels.end());
+
+	std::vector<long long> fenwick(defense_levels.size() + 1, 0);
+
+	std::vector<bool> keep(source.size(), false);
+	for (size_t i : order)
+	{
+		size_t rank = std::lower_bound(
+						  defense_levels.begin(), defense_levels.end(),
+						  source[i]->defense(), std::greater<double>()) -
+					  defense_levels.begin();
+
+		long long dominator_cost = 0;
+		for (size_t k = rank + 1; k > 0; k -= k & (~k + 1))
+		{
+			dominator_cost += fenwick[k];
+		}
+
+		if (source[i]->cost() + dominator_cost > total_cost)
+		{
+			counters.dominated++;
+		}
+		else
+		{
+			keep[i] = true;
+		}
+
+		for (size_t k = rank + 1; k < fenwick.size(); k += k & (~k + 1))
+		{
+			fenwick[k] += source[i]->cost();
+		}
+	}
+
+	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		if (keep[i])
+		{
+			result->push_back(source[i]);
+		}
+	}
+	counters.output = result->size();
+
+	if (stats)
+	{
+		*stats = counters;
+	}
+
+	return result;
+}
+
+// Compact result of a solver: the catalog indices of the chosen armor items,
+// in the order the solver returns them, along with their totals. The solvers
+// below build one of these instead of copying shared_ptrs into an ArmorVector;
+// materialize_selection gives the ArmorVector only when the items themselves
+// are needed.
+struct ArmorSelection
+{
+	std::vector<size_t> indices;
+	int total_cost = 0;
+	double total_defense = 0;
+};
+
+// Build the ArmorVector holding the armors of selection, in the same order.
+std::unique_ptr<ArmorVector> materialize_selection(
+	const ArmorVector &armors,
+	const ArmorSelection &selection)
+{
+	std::unique_ptr<ArmorVector> result(new ArmorVector);
+	result->reserve(selection.indices.size());
+	for (size_t i : selection.indices)
+	{
+		result->push_back(armors[i]);
+	}
+	return result;
+}
+
+// One take/skip bit per armor item and budget, packed 64 to a word, for
+// reconstructing a dynamic programming solution from a single DP row.
+// The words live in a Table2D, on huge pages once the matrix is big
+// enough for that to matter.
+class DecisionBits
+{
+	//
+public:
+	//
+	DecisionBits(size_t rows, size_t columns)
+		: _words(rows, (columns + 63) / 64, rows * columns / 8 >= huge_page_threshold)
+	{
+	}
+
+	void set(size_t row, size_t column)
+	{
+		_words(row, column / 64) |= uint64_t(1) << (column % 64);
+	}
+
+	bool test(size_t row, size_t column) const
+	{
+		return (_words(row, column / 64) >> (column % 64)) & 1;
+	}
+
+	// The words of one row, for kernels that set many bits at once.
+	uint64_t *row(size_t i) { return _words.row(i); }
+
+	size_t bytes() const { return _words.bytes(); }
+
+	//
+private:
+	static constexpr size_t huge_page_threshold = size_t(16) << 20;
+
+	Table2D<uint64_t> _words;
+};
+
+// Instruction sets for the DP row kernel, detected at run time.
+enum class SimdLevel
+{
+	Scalar,
+	AVX2,
+	AVX512
+};
+
+// The widest SimdLevel this machine supports.
+SimdLevel simd_level_supported()
+{
+#ifdef MAXDEFENSE_X86
+	static const SimdLevel level =
+		__builtin_cpu_supports("avx512f") ? SimdLevel::AVX512
+		: __builtin_cpu_supports("avx2")  ? SimdLevel::AVX2
+										  : SimdLevel::Scalar;
+	return level;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+// Add one item to a DP row, for budgets j in [begin, end), with begin at
+// least cost: row[j] becomes source[j - cost] + defense where that is
+// greater than source[j], and source[j] otherwise, and the item's bit j is
+// set in taken, if there is one. source is the row without the item; it
+// may be row itself, since j runs downwards and row[j - cost] is then
+// still the value without the item.
+void dynamic_row_update_scalar(
+	const double *source,
+	double *row,
+	size_t begin,
+	size_t end,
+	size_t cost,
+	double defense,
+	uint64_t *taken)
+{
+	for (size_t j = end; j-- > begin;)
+	{
+		double old = source[j];
+		double candidate = source[j - cost] + defense;
+		if (candidate > old)
+		{
+			row[j] = candidate;
+			if (taken)
+			{
+				taken[j / 64] |= uint64_t(1) << (j % 64);
+			}
+		}
+		else
+		{
+			row[j] = old;
+		}
+	}
+}
+
+#ifdef MAXDEFENSE_X86
+// dynamic_row_update_scalar 4 budgets at a time. Blocks are aligned to 4
+// budgets so their bits land in one word, and are taken from the top
+// down; every load of a block happens before its store, so an in-place
+// update reads only values without the item, whatever the cost. The
+// compare-and-blend is the scalar test, so the row is bit-exact.
+__attribute__((target("avx2"))) void dynamic_row_update_avx2(
+	const double *source,
+	double *row,
+	size_t begin,
+	size_t end,
+	size_t cost,
+	double defense,
+	uint64_t *taken)
+{
+	const size_t lanes = 4;
+	size_t block = std::max(begin, end & ~(lanes - 1));
+	dynamic_row_update_scalar(source, row, block, end, cost, defense, taken);
+
+	const __m256d add = _mm256_set1_pd(defense);
+	while (block >= begin + lanes)
+	{
+		block -= lanes;
+		__m256d old = _mm256_loadu_pd(source + block);
+		__m256d candidate = _mm256_add_pd(_mm256_loadu_pd(source + block - cost), add);
+		__m256d better = _mm256_cmp_pd(candidate, old, _CMP_GT_OQ);
+		_mm256_storeu_pd(row + block, _mm256_blendv_pd(old, candidate, better));
+
+		uint64_t bits = _mm256_movemask_pd(better);
+		if (bits && taken)
+		{
+			taken[block / 64] |= bits << (block % 64);
+		}
+	}
+
+	dynamic_row_update_scalar(source, row, begin, block, cost, defense, taken);
+}
+
+// The same with 8 budgets per AVX-512 register and mask registers.
+__attribute__((target("avx512f"))) void dynamic_row_update_avx512(
+	const double *source,
+	double *row,
+	size_t begin,
+	size_t end,
+	size_t cost,
+	double defense,
+	uint64_t *taken)
+{
+	const size_t lanes = 8;
+	size_t block = std::max(begin, end & ~(lanes - 1));
+	dynamic_row_update_scalar(source, row, block, end, cost, defense, taken);
+
+	const __m512d add = _mm512_set1_pd(defense);
+	while (block >= begin + lanes)
+	{
+		block -= lanes;
+		__m512d old = _mm512_loadu_pd(source + block);
+		__m512d candidate = _mm512_add_pd(_mm512_loadu_pd(source + block - cost), add);
+		__mmask8 better = _mm512_cmp_pd_mask(candidate, old, _CMP_GT_OQ);
+		_mm512_storeu_pd(row + block, _mm512_mask_blend_pd(better, old, candidate));
+
+		if (better && taken)
+		{
+			taken[block / 64] |= uint64_t(better) << (block % 64);
+		}
+	}
+
+	dynamic_row_update_scalar(source, row, begin, block, cost, defense, taken);
+}
+#endif
+
+// Add one item to the budgets [begin, end) of a DP row, from the row
+// without it in source, with the kernel for level; budgets below the
+// item's cost are copied from source. See dynamic_row_update_scalar.
+void dynamic_row_update(
+	const double *source,
+	double *row,
+	size_t begin,
+	size_t end,
+	size_t cost,
+	double defense,
+	uint64_t *taken,
+	SimdLevel level = simd_level_supported())
+{
+	if (begin < cost)
+	{
+		if (source != row)
+		{
+			std::copy(source + begin, source + std::min(cost, end), row + begin);
+		}
+		begin = cost;
+	}
+	if (begin >= end)
+	{
+		return;
+	}
+
+	switch (level)
+	{
+#ifdef MAXDEFENSE_X86
+	case SimdLevel::AVX512:
+		dynamic_row_update_avx512(source, row, begin, end, cost, defense, taken);
+		break;
+	case SimdLevel::AVX2:
+		dynamic_row_update_avx2(source, row, begin, end, cost, defense, taken);
+		break;
+#endif
+	default:
+		dynamic_row_update_scalar(source, row, begin, end, cost, defense, taken);
+		break;
+	}
+}
+
+// Add one item to a whole DP row of width budgets, in place.
+void dynamic_row_update(
+	double *row,
+	size_t width,
+	size_t cost,
+	double defense,
+	uint64_t *taken,
+	SimdLevel level = simd_level_supported())
+{
+	dynamic_row_update(row, row, 0, width, cost, defense, taken, level);
+}
+
+// How the dynamic algorithms shrank their table; see compress_costs.
+// reduction is the original table width over the compressed one.
+struct CompressionStats
+{
+	size_t items_dropped = 0;
+	size_t gcd = 1;
+	size_t original_width = 0;
+	size_t compressed_width = 0;
+	double reduction = 1;
+};
+
+// The items and budget a dynamic algorithm actually needs. Items costing
+// more than the budget can never be chosen and are dropped. The costs
+// that remain, and the budget, are divided by their greatest common
+// divisor, since every sum of costs is a multiple of it. The budget is
+// then capped at the sum of the remaining costs, beyond which every row
+// is flat.
+//
+// None of this changes a DP value or decision that the backtrack reads,
+// so the selection is the same as on the full table.
+struct CostCompression
+{
+	std::vector<size_t> items;
+	std::vector<size_t> costs;
+	int budget = 0;
+	CompressionStats stats;
+};
+
+CostCompression compress_costs(const ArmorVector &armors, int total_cost)
+{
+	CostCompression compression;
+	compression.stats.original_width = std::max(total_cost, -1) + 1;
+
+	size_t gcd = 0, sum = 0;
+	for (size_t i = 0; i < armors.size(); i++)
+	{
+		size_t cost = armors[i]->cost();
+		if (total_cost >= 0 && cost <= size_t(total_cost))
+		{
+			compression.items.push_back(i);
+			compression.costs.push_back(cost);
+			gcd = std::gcd(gcd, cost);
+			sum += cost;
+		}
+	}
+	gcd = std::max<size_t>(gcd, 1);
+
+	for (size_t &cost : compression.costs)
+	{
+		cost /= gcd;
+	}
+	compression.budget = total_cost < 0 ? -1 : std::min<size_t>(total_cost / gcd, sum / gcd);
+
+	compression.stats.items_dropped = armors.size() - compression.items.size();
+	compression.stats.gcd = gcd;
+	compression.stats.compressed_width = compression.budget + 1;
+	compression.stats.reduction = compression.stats.compressed_width
+									  ? double(compression.stats.original_width) / compression.stats.compressed_width
+									  : 1;
+	return compression;
+}
+
+// Follow the decision bits of a dynamic algorithm over the compressed
+// items back from the compressed budget, given the best defense in the
+// last DP row, listing the chosen armors from the last catalog index to
+// the first.
+ArmorSelection dynamic_backtrack(
+	const ArmorVector &armors,
+	const CostCompression &compression,
+	double optimum,
+	const DecisionBits &taken)
+{
+	ArmorSelection bestArmor;
+
+	int max_cache = optimum;
+
+	auto w = compression.budget;
+
+	for (int k = compression.items.size(); k > 0 && max_cache > 0; k--)
+	{
+		if (taken.test(k - 1, w))
+		{
+			size_t i = compression.items[k - 1];
+			bestArmor.indices.push_back(i);
+			bestArmor.total_cost += armors.at(i)->cost();
+			bestArmor.total_defense += armors.at(i)->defense();
+			w = w - compression.costs[k - 1];
+		}
+	}
+
+	return bestArmor;
+}
+
 // Compute the optimal set of armor items with a dynamic algorithm.
 // Specifically, among the armor items that fit within a total_cost gold budget,
 // choose the selection of armors whose defense is greatest.
 // Repeat until no more armor items can be chosen, either because we've run out of armor items,
 // or run out of gold.
-std::unique_ptr<ArmorVector> dynamic_max_defense(
+// The chosen armors are listed from the last catalog index to the first.
+//
+// Only one DP row is kept: row[j] is the best defense within j gold using
+// the items seen so far, and each item updates it in place from j = W down
+// to its cost, so row[j - cost] still holds the previous item's value.
+// Whether item i was taken at budget j, i.e. whether the full table would
+// have cache[i + 1][j] != cache[i][j], goes into a packed bit matrix, and
+// the backtrack follows those bits. That is n x W bits instead of n x W
+// doubles, with the same selection as the full table.
+//
+// Each row update runs through dynamic_row_update, vectorized for level,
+// and the table is first shrunk by compress_costs; stats, if given,
+// reports by how much.
+ArmorSelection dynamic_max_defense_selection(
 	const ArmorVector &armors,
-	int total_cost)
+	int total_cost,
+	SimdLevel level = simd_level_supported(),
+	CompressionStats *stats = nullptr)
 {
-	std::unique_ptr<ArmorVector> bestArmor(new ArmorVector);
+	PROFILE_SCOPE("dynamic_max_defense");
 
-	// Similar to Knapsack problem, make two arrays, one weighted with gold values, other with corresponding defense values
-	// Split armors vector into two separate vectors, X(wt) array weight = gold_cost of item(), V(val) array value = item_defense()
-	// W = total_cost, n = size of armors
+	const CostCompression compression = compress_costs(armors, total_cost);
+	if (stats)
+	{
+		*stats = compression.stats;
+	}
+	if (compression.budget < 0)
+	{
+		return ArmorSelection();
+	}
 
-	const size_t n = armors.size() + 1;
-	const size_t W = total_cost + 1;
+	const size_t n = compression.items.size();
+	const size_t W = compression.budget + 1;
 
-	std::vector<std::vector<double>> cache;
+	std::vector<double> row(W, 0.0);
+	DecisionBits taken(n, W);
 
-	cache.resize(n);
+	for (size_t k = 0; k < n; ++k)
+	{
+		dynamic_row_update(row.data(), W, compression.costs[k], armors[compression.items[k]]->defense(), taken.row(k), level);
+	}
 
-	// initialzie gold cost and defense value vectors to 0
-	for (size_t i = 0; i < n; cache[i].resize(W), ++i)
-		;
+	return dynamic_backtrack(armors, compression, row[compression.budget], taken);
+}
 
-	for (size_t i = 0; i < W; cache[0][i] = 0, ++i)
-		;
+// A barrier for a fixed number of threads that can be reused round after
+// round (std::barrier is C++20). Rows take microseconds, so waiters spin on
+// a sense flag that the last thread to arrive reverses, instead of paying a
+// mutex and a futex wake per row. Past spin_limit tries they yield, so
+// more threads than cores still make progress; with no spare cores to spin
+// on, pass a spin_limit of 0.
+//
+// cancel releases every waiter, now and later, with a false return, for
+// when a thread that was counted on will never arrive.
+class RowBarrier
+{
+	//
+public:
+	//
+	explicit RowBarrier(unsigned count, unsigned spin_limit = 1024)
+		: _count(count), _spin_limit(spin_limit), _remaining(count) { }
 
-	for (size_t i = 0; i < armors.size(); ++i)
+	bool arrive_and_wait()
 	{
-		for (size_t j = 0; j < W; ++j)
+		// Only the last arrival of the previous round changed the flag, and
+		// this thread saw that change before it got here.
+		const bool sense = !_sense.load(std::memory_order_relaxed);
+		if (_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			_remaining.store(_count, std::memory_order_relaxed);
+			_sense.store(sense, std::memory_order_release);
+			return !_cancelled.load(std::memory_order_relaxed);
+		}
+
+		for (unsigned spins = 0; _sense.load(std::memory_order_acquire) != sense; spins++)
 		{
-			if (j >= armors[i]->cost())
+			if (_cancelled.load(std::memory_order_relaxed))
+			{
+				return false;
+			}
+			if (spins < _spin_limit)
 			{
-				cache[i + 1][j] = std::max(cache[i][j], cache[i][j - armors[i]->cost()] + armors[i]->defense());
+#ifdef MAXDEFENSE_X86
+				_mm_pause();
+#endif
 			}
 			else
 			{
-				cache[i + 1][j] = cache[i][j];
+				std::this_thread::yield();
 			}
 		}
+		return true;
 	}
 
-	int max_cache = cache[armors.size()][total_cost];
+	void cancel()
+	{
+		_cancelled.store(true, std::memory_order_relaxed);
+	}
 
-	auto w = total_cost;
+	//
+private:
+	const unsigned _count;
+	const unsigned _spin_limit;
+	std::atomic<unsigned> _remaining;
+	std::atomic<bool> _sense{false};
+	std::atomic<bool> _cancelled{false};
+};
 
-	for (int i = armors.size(); i > 0 && max_cache > 0; i--)
+// Same as dynamic_max_defense_selection, with the budgets of each row split
+// across thread_count threads. A row depends only on the previous one, so
+// the rows are double buffered: each thread fills its own column range of
+// the next row from the previous row, then all threads meet at a barrier
+// before the next item. The ranges are whole 64-budget words, so no two
+// threads touch the same decision word. The threads are started once and
+// kept for every row.
+//
+// The kernel and the decisions are those of dynamic_max_defense_selection,
+// so the selection is identical for any thread count.
+ArmorSelection dynamic_max_defense_parallel_selection(
+	const ArmorVector &armors,
+	int total_cost,
+	unsigned thread_count = std::thread::hardware_concurrency())
+{
+	PROFILE_SCOPE("dynamic_max_defense_parallel");
+
+	const CostCompression compression = compress_costs(armors, total_cost);
+	if (compression.budget < 0)
 	{
-		if (cache[i][w] != cache[i - 1][w])
+		return ArmorSelection();
+	}
+
+	const size_t n = compression.items.size();
+	const size_t W = compression.budget + 1;
+	const size_t words = (W + 63) / 64;
+	thread_count = std::max<size_t>(1, std::min<size_t>(thread_count, words));
+
+	const std::vector<size_t> &costs = compression.costs;
+	std::vector<double> defenses(n);
+	for (size_t k = 0; k < n; k++)
+	{
+		defenses[k] = armors[compression.items[k]]->defense();
+	}
+
+	std::vector<double> rows[2] = {std::vector<double>(W, 0.0), std::vector<double>(W, 0.0)};
+	DecisionBits taken(n, W);
+	RowBarrier barrier(thread_count, thread_count <= std::thread::hardware_concurrency() ? 1024 : 0);
+	const SimdLevel level = simd_level_supported();
+
+	auto work = [&](unsigned t) {
+		const size_t begin = std::min(W, words * t / thread_count * 64);
+		const size_t end = std::min(W, words * (t + 1) / thread_count * 64);
+		for (size_t i = 0; i < n; i++)
 		{
-			bestArmor->push_back(armors.at(i - 1));
-			w = w - armors.at(i - 1)->cost();
+			dynamic_row_update(rows[i % 2].data(), rows[(i + 1) % 2].data(), begin, end, costs[i], defenses[i], taken.row(i), level);
+			if (!barrier.arrive_and_wait())
+			{
+				return;
+			}
+		}
+	};
+
+	// If a thread cannot be started, the ones that were wait at the barrier
+	// for a thread that will never come: release and join them before
+	// passing the error on.
+	std::vector<std::thread> pool;
+	try
+	{
+		for (unsigned t = 1; t < thread_count; t++)
+		{
+			pool.emplace_back(work, t);
 		}
 	}
+	catch (...)
+	{
+		barrier.cancel();
+		for (auto &thread : pool)
+		{
+			thread.join();
+		}
+		throw;
+	}
+	work(0);
+	for (auto &thread : pool)
+	{
+		thread.join();
+	}
 
-	return bestArmor;
+	return dynamic_backtrack(armors, compression, rows[n % 2][compression.budget], taken);
+}
+
+// Update a DP row in place with one more item: row[j] becomes the best
+// defense within j gold, with or without the item.
+void dynamic_row_add(std::vector<double> &row, size_t cost, double defense)
+{
+	dynamic_row_update(row.data(), row.size(), cost, defense, nullptr);
+}
+
+// The DP row over items [first, last) of costs and defenses for budgets
+// 0 .. total_cost.
+std::vector<double> dynamic_row(
+	const std::vector<size_t> &costs,
+	const std::vector<double> &defenses,
+	size_t first,
+	size_t last,
+	int total_cost)
+{
+	std::vector<double> row(total_cost + 1, 0.0);
+	for (size_t i = first; i < last; i++)
+	{
+		dynamic_row_add(row, costs[i], defenses[i]);
+	}
+	return row;
+}
+
+// Compute the optimal set of armor items with a dynamic algorithm in O(W)
+// memory, independent of n, by Hirschberg's divide and conquer: split the
+// items in half, compute the DP row of each half, and pick the budget split
+// b maximizing front[b] + back[total_cost - b]; then solve each half with
+// its share of the budget. The rows are freed before recursing, so only
+// O(W) doubles are live per level, for about twice the arithmetic of
+// dynamic_max_defense_selection.
+//
+// Ranges small enough that their decision bits fit in base_bits are solved
+// directly with a DecisionBits backtrack. The items and budget are first
+// shrunk by compress_costs, as for dynamic_max_defense_selection; stats, if
+// given, reports by how much.
+//
+// The total defense is optimal, but among equally good selections this may
+// choose a different one than dynamic_max_defense_selection. The chosen
+// armors are listed from the last catalog index to the first.
+ArmorSelection dynamic_max_defense_hirschberg_selection(
+	const ArmorVector &armors,
+	int total_cost,
+	size_t base_bits = size_t(1) << 16,
+	CompressionStats *stats = nullptr)
+{
+	PROFILE_SCOPE("dynamic_max_defense_hirschberg");
+
+	ArmorSelection selection;
+	const CostCompression compression = compress_costs(armors, total_cost);
+	if (stats)
+	{
+		*stats = compression.stats;
+	}
+	if (compression.budget < 0)
+	{
+		return selection;
+	}
+
+	const std::vector<size_t> &costs = compression.costs;
+	std::vector<double> defenses(costs.size());
+	for (size_t k = 0; k < costs.size(); k++)
+	{
+		defenses[k] = armors[compression.items[k]]->defense();
+	}
+
+	auto take = [&](size_t k) {
+		size_t i = compression.items[k];
+		selection.indices.push_back(i);
+		selection.total_cost += armors[i]->cost();
+		selection.total_defense += armors[i]->defense();
+	};
+
+	std::function<void(size_t, size_t, int)> solve = [&](size_t first, size_t last, int budget) {
+		if (first == last)
+		{
+			return;
+		}
+
+		if ((last - first) * size_t(budget + 1) <= base_bits || last - first == 1)
+		{
+			std::vector<double> row(budget + 1, 0.0);
+			DecisionBits taken(last - first, budget + 1);
+			for (size_t i = first; i < last; i++)
+			{
+				dynamic_row_update(row.data(), row.size(), costs[i], defenses[i], taken.row(i - first));
+			}
+
+			int w = budget;
+			for (size_t i = last; i > first; i--)
+			{
+				if (taken.test(i - 1 - first, w))
+				{
+					take(i - 1);
+					w -= costs[i - 1];
+				}
+			}
+			return;
+		}
+
+		const size_t middle = first + (last - first) / 2;
+		int split = 0;
+		{
+			std::vector<double> front = dynamic_row(costs, defenses, first, middle, budget);
+			std::vector<double> back = dynamic_row(costs, defenses, middle, last, budget);
+			for (int b = 1; b <= budget; b++)
+			{
+				if (front[b] + back[budget - b] > front[split] + back[budget - split])
+				{
+					split = b;
+				}
+			}
+		}
+
+		solve(middle, last, budget - split);
+		solve(first, middle, split);
+	};
+
+	solve(0, costs.size(), compression.budget);
+	return selection;
+}
+
+// How dynamic_max_defense reconstructs the chosen armors: from a packed
+// n x W decision bit matrix, or with the O(W) divide and conquer.
+enum class DynamicMode
+{
+	DecisionBits,
+	Hirschberg
+};
+
+// dynamic_max_defense_selection or dynamic_max_defense_hirschberg_selection,
+// as an ArmorVector. stats, if given, reports how compress_costs shrank the
+// table.
+std::unique_ptr<ArmorVector> dynamic_max_defense(
+	const ArmorVector &armors,
+	int total_cost,
+	DynamicMode mode = DynamicMode::DecisionBits,
+	CompressionStats *stats = nullptr)
+{
+	return materialize_selection(
+		armors,
+		mode == DynamicMode::Hirschberg
+			? dynamic_max_defense_hirschberg_selection(armors, total_cost, size_t(1) << 16, stats)
+			: dynamic_max_defense_selection(armors, total_cost, simd_level_supported(), stats));
 }
 
 // Compute the optimal set of armor items with an exhaustive search algorithm.
@@ -325,44 +1161,280 @@ std::unique_ptr<ArmorVector> dynamic_max_defense(
 // return the subset whose gold cost fits within the total_cost budget,
 // and whose total defense is greatest.
 // To avoid overflow, the size of the armor items vector must be less than 64.
-std::unique_ptr<ArmorVector> exhaustive_max_defense(
+// Each subset is a bitmask over the armors, summed from flat cost and defense
+// arrays, and the best one is kept as a mask, so the loop allocates nothing.
+ArmorSelection exhaustive_max_defense_selection(
 	const ArmorVector &armors,
 	double total_cost)
 {
+	PROFILE_SCOPE("exhaustive_max_defense");
+
 	const int n = armors.size();
 	assert(n < 64);
 
-	std::unique_ptr<ArmorVector> bestArmor_vec(new ArmorVector);
-	int candidate_cost, best_cost;
-	double candidate_defense, best_defense;
+	std::vector<int> costs(n);
+	std::vector<double> defenses(n);
+	for (int j = 0; j < n; j++)
+	{
+		costs[j] = armors[j]->cost();
+		defenses[j] = armors[j]->defense();
+	}
+
+	bool found = false;
+	uint64_t best_mask = 0;
+	long long best_cost = 0;
+	double best_defense = 0;
 
-	for (uint64_t i = 0; i <= (pow(2, n) - 1); i++)
+	for (uint64_t i = 0; i < (uint64_t(1) << n); i++)
 	{
-		std::unique_ptr<ArmorVector> candidate_vec(new ArmorVector);
-		for (uint64_t j = 0; j <= n - 1; j++)
+		long long candidate_cost = 0;
+		double candidate_defense = 0;
+		for (int j = 0; j < n; j++)
 		{
-			if (((i >> j) & 1) == 1)
+			if ((i >> j) & 1)
 			{
-				//std::cout << "Bitwise if Loop Running" << std::endl;
-				candidate_vec->push_back(armors.at(j));
+				candidate_cost += costs[j];
+				candidate_defense += defenses[j];
 			}
 		}
-		sum_armor_vector(*candidate_vec, candidate_cost, candidate_defense);
-		sum_armor_vector(*bestArmor_vec, best_cost, best_defense);
 
-		if (candidate_cost <= total_cost)
+		if (candidate_cost <= total_cost && (!found || candidate_defense > best_defense))
 		{
-			if (bestArmor_vec->empty() || candidate_defense > best_defense)
-			{
-				bestArmor_vec->clear();
+			found = true;
+			best_mask = i;
+			best_cost = candidate_cost;
+			best_defense = candidate_defense;
+		}
+	}
 
-				for (int k = 0; k < candidate_vec->size(); k++)
-				{
-					bestArmor_vec->push_back(candidate_vec->at(k));
-				}
-			}
+	ArmorSelection selection;
+	for (int j = 0; j < n; j++)
+	{
+		if ((best_mask >> j) & 1)
+		{
+			selection.indices.push_back(j);
 		}
 	}
+	selection.total_cost = best_cost;
+	selection.total_defense = best_defense;
+	return selection;
+}
 
-	return bestArmor_vec;
+// exhaustive_max_defense_selection, as an ArmorVector in catalog order.
+std::unique_ptr<ArmorVector> exhaustive_max_defense(
+	const ArmorVector &armors,
+	double total_cost)
+{
+	return materialize_selection(armors, exhaustive_max_defense_selection(armors, total_cost));
 }
+
+// Which path an ArmorCatalog update took: updated in time proportional to
+// the change, or rebuilt from every item in the catalog.
+enum class UpdatePath
+{
+	Incremental,
+	Rebuild
+};
+
+// A catalog that changes one item at a time, keeping its solver state up
+// to date instead of reloading and re-solving from scratch.
+//
+// Items get ids in the order they are added, and the catalog order is id
+// order. Two pieces of state are maintained:
+//
+// - the greedy order, items sorted by defense per gold, in a std::set,
+//   updated in O(log n) on add and remove;
+// - the last row of the dynamic table up to a budget capacity, so that
+//   row[j] is the best defense within j gold. Adding an item is one
+//   in-place O(W) pass over the row. Removing an item cannot be undone on
+//   the row, since max forgets which side won, so it rebuilds the row in
+//   O(nW), unless the item could never fit and the row is unchanged.
+//   Asking for a budget above the capacity also rebuilds, at the larger
+//   capacity.
+//
+// The row is built in catalog order with the same additions as
+// dynamic_max_defense, so optimum_defense matches it exactly on armors().
+class ArmorCatalog
+{
+	//
+public:
+	//
+	explicit ArmorCatalog(int capacity = 0)
+		: _row(std::max(capacity, 0) + 1, 0.0)
+	{
+	}
+
+	ArmorCatalog(const ArmorVector &armors, int capacity)
+		: ArmorCatalog(capacity)
+	{
+		for (auto &item : armors)
+		{
+			add(item);
+		}
+	}
+
+	// Add an item and return its id.
+	size_t add(std::shared_ptr<ArmorItem> item)
+	{
+		assert(item);
+		size_t id = _next_id++;
+		_items.emplace(id, item);
+		_greedy.insert(GreedyKey{ratio(*item), id});
+
+		add_to_row(*item);
+		record(UpdatePath::Incremental);
+		return id;
+	}
+
+	// Remove the item with the given id, if it is in the catalog.
+	bool remove(size_t id)
+	{
+		auto found = _items.find(id);
+		if (found == _items.end())
+		{
+			return false;
+		}
+
+		const ArmorItem &item = *found->second;
+		_greedy.erase(GreedyKey{ratio(item), id});
+		bool fits = item.cost() < int(_row.size()) && item.defense() > 0;
+		_items.erase(found);
+
+		if (fits)
+		{
+			rebuild_row(capacity());
+		}
+		else
+		{
+			record(UpdatePath::Incremental);
+		}
+		return true;
+	}
+
+	size_t size() const { return _items.size(); }
+	int capacity() const { return int(_row.size()) - 1; }
+
+	// The path taken by the last add, remove or capacity change, and how
+	// many of each have happened.
+	UpdatePath last_update() const { return _last_update; }
+	size_t incremental_updates() const { return _incremental_updates; }
+	size_t rebuilds() const { return _rebuilds; }
+
+	// The greatest defense of any selection within total_cost gold.
+	double optimum_defense(int total_cost)
+	{
+		if (total_cost < 0)
+		{
+			return 0;
+		}
+		if (total_cost > capacity())
+		{
+			rebuild_row(total_cost);
+		}
+		return _row[total_cost];
+	}
+
+	// Take items in order of defense per gold while they fit, skipping the
+	// ones that do not. Indices are item ids, in the order taken.
+	ArmorSelection greedy_selection(int total_cost) const
+	{
+		ArmorSelection selection;
+		for (const GreedyKey &key : _greedy)
+		{
+			const ArmorItem &item = *_items.at(key.id);
+			if (selection.total_cost + item.cost() <= total_cost)
+			{
+				selection.indices.push_back(key.id);
+				selection.total_cost += item.cost();
+				selection.total_defense += item.defense();
+			}
+		}
+		return selection;
+	}
+
+	// The items in catalog order, and their ids in the same order, for
+	// running any other solver on the current contents.
+	std::unique_ptr<ArmorVector> armors() const
+	{
+		std::unique_ptr<ArmorVector> result(new ArmorVector);
+		result->reserve(_items.size());
+		for (auto &entry : _items)
+		{
+			result->push_back(entry.second);
+		}
+		return result;
+	}
+
+	std::vector<size_t> ids() const
+	{
+		std::vector<size_t> result;
+		result.reserve(_items.size());
+		for (auto &entry : _items)
+		{
+			result.push_back(entry.first);
+		}
+		return result;
+	}
+
+	//
+private:
+	// Best ratio first; equal ratios in catalog order.
+	struct GreedyKey
+	{
+		double ratio;
+		size_t id;
+
+		bool operator<(const GreedyKey &other) const
+		{
+			return ratio != other.ratio ? ratio > other.ratio : id < other.id;
+		}
+	};
+
+	static double ratio(const ArmorItem &item)
+	{
+		return item.cost() > 0 ? item.defense() / item.cost() : HUGE_VAL;
+	}
+
+	void add_to_row(const ArmorItem &item)
+	{
+		const int cost = item.cost();
+		const double defense = item.defense();
+		for (int j = capacity(); j >= cost; j--)
+		{
+			_row[j] = std::max(_row[j], _row[j - cost] + defense);
+		}
+	}
+
+	void rebuild_row(int capacity)
+	{
+		PROFILE_SCOPE("ArmorCatalog::rebuild_row");
+
+		_row.assign(capacity + 1, 0.0);
+		for (auto &entry : _items)
+		{
+			add_to_row(*entry.second);
+		}
+		record(UpdatePath::Rebuild);
+	}
+
+	void record(UpdatePath path)
+	{
+		_last_update = path;
+		if (path == UpdatePath::Incremental)
+		{
+			_incremental_updates++;
+		}
+		else
+		{
+			_rebuilds++;
+		}
+	}
+
+	std::map<size_t, std::shared_ptr<ArmorItem>> _items;
+	std::set<GreedyKey> _greedy;
+	std::vector<double> _row;
+	size_t _next_id = 0;
+	UpdatePath _last_update = UpdatePath::Incremental;
+	size_t _incremental_updates = 0;
+	size_t _rebuilds = 0;
+};
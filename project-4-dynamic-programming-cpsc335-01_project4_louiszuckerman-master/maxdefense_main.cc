@@ -11,18 +11,41 @@ int main()
 
 	Timer time;
 
-	dynamic_max_defense(*dynamic_armors, 100);
+	CompressionStats compression;
+	dynamic_max_defense(*dynamic_armors, 100, DynamicMode::DecisionBits, &compression);
 	double elapsed = time.elapsed();
 
 	std::cout << "Dynamic n: " << dynamic_n << " Time: " << elapsed << std::endl;
+	std::cout
+		<< "Dynamic table width: " << compression.original_width << " -> " << compression.compressed_width
+		<< " (gcd " << compression.gcd << ", " << compression.items_dropped << " items over budget, "
+		<< compression.reduction << "x smaller)" << std::endl;
 
 	int exhaustive_n = 20;		//alter for test
 	std::unique_ptr<ArmorVector> exhaustive_armors = filter_armor_vector(*all_armor, 1, 2500, exhaustive_n);
+
+	time.reset();
 	exhaustive_max_defense(*exhaustive_armors, 100);
 	elapsed = time.elapsed();
 
 	std::cout << "Exhaustive n: " << exhaustive_n << " Time: " << elapsed << std::endl;
 
+	int parallel_budget = 100000;		//alter for test
+	unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned threads = 1;; threads = std::min(threads * 2, max_threads))
+	{
+		time.reset();
+		dynamic_max_defense_parallel_selection(*dynamic_armors, parallel_budget, threads);
+		elapsed = time.elapsed();
+
+		std::cout << "Parallel dynamic n: " << dynamic_n << " budget: " << parallel_budget << " threads: " << threads << " Time: " << elapsed << std::endl;
+
+		if (threads == max_threads)
+		{
+			break;
+		}
+	}
+
 
 	return 0;
 }
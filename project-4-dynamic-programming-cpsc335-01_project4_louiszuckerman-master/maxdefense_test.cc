@@ -14,6 +14,45 @@
 #include "rubrictest.hh"
 
 
+// The original full-table dynamic algorithm, kept as a reference for the
+// memory-saving versions in maxdefense.hh: the catalog indices it chooses,
+// from the last to the first.
+std::vector<size_t> reference_dynamic_indices(const ArmorVector &armors, int total_cost)
+{
+	const size_t n = armors.size() + 1;
+	const size_t W = total_cost + 1;
+
+	std::vector<std::vector<double>> cache(n, std::vector<double>(W, 0));
+	for (size_t i = 0; i < armors.size(); ++i)
+	{
+		for (size_t j = 0; j < W; ++j)
+		{
+			if (j >= size_t(armors[i]->cost()))
+			{
+				cache[i + 1][j] = std::max(cache[i][j], cache[i][j - armors[i]->cost()] + armors[i]->defense());
+			}
+			else
+			{
+				cache[i + 1][j] = cache[i][j];
+			}
+		}
+	}
+
+	std::vector<size_t> indices;
+	int max_cache = cache[armors.size()][total_cost];
+	int w = total_cost;
+	for (int i = armors.size(); i > 0 && max_cache > 0; i--)
+	{
+		if (cache[i][w] != cache[i - 1][w])
+		{
+			indices.push_back(i - 1);
+			w -= armors[i - 1]->cost();
+		}
+	}
+	return indices;
+}
+
+
 int main()
 {
 	Rubric rubric;
@@ -205,6 +244,327 @@ int main()
 			}
 		}
 	);
+
+	//
+	rubric.criterion(
+		"prune_armor_vector keeps the optimum", 2,
+		[&]()
+		{
+			PruneStats stats;
+			auto pruned = prune_armor_vector(trivial_armors, 9, &stats);
+			TEST_TRUE("non-null", pruned);
+			TEST_EQUAL("helmet over budget", 1, stats.over_budget);
+			TEST_EQUAL("boots kept", 1, pruned->size());
+			TEST_EQUAL("boots kept", "test boots", (*pruned)[0]->description());
+			
+			for (int total_cost : {100, 500, 5000})
+			{
+				pruned = prune_armor_vector(*all_armors, total_cost, &stats);
+				TEST_EQUAL("counters add up", stats.input, stats.over_budget + stats.no_defense + stats.dominated + stats.output);
+				TEST_EQUAL("output size", pruned->size(), stats.output);
+				TEST_LT("input shrank", stats.output, stats.input);
+				
+				auto expected = dynamic_max_defense(*all_armors, total_cost);
+				auto actual = dynamic_max_defense(*pruned, total_cost);
+				
+				int expected_cost, actual_cost;
+				double expected_defense, actual_defense;
+				sum_armor_vector(*expected, expected_cost, expected_defense);
+				sum_armor_vector(*actual, actual_cost, actual_defense);
+				TEST_EQUAL("same defense", std::round(expected_defense * 100), std::round(actual_defense * 100));
+			}
+		}
+	);
+
+	//
+	rubric.criterion(
+		"ArmorSelection results agree with the original solvers", 2,
+		[&]()
+		{
+			auto small_armors = filter_armor_vector(*filtered_armors, 1, 2000, 12);
+			
+			// The original exhaustive loop: every mask in counting order,
+			// the first best one kept.
+			auto baseline_exhaustive = [](const ArmorVector &armors, int total_cost)
+			{
+				bool found = false;
+				uint64_t best_mask = 0;
+				double best_defense = 0;
+				for (uint64_t mask = 0; mask < (uint64_t(1) << armors.size()); mask++)
+				{
+					int cost = 0;
+					double defense = 0;
+					for (size_t j = 0; j < armors.size(); j++)
+					{
+						if ((mask >> j) & 1)
+						{
+							cost += armors[j]->cost();
+							defense += armors[j]->defense();
+						}
+					}
+					if (cost <= total_cost && (!found || defense > best_defense))
+					{
+						found = true;
+						best_mask = mask;
+						best_defense = defense;
+					}
+				}
+				std::vector<size_t> indices;
+				for (size_t j = 0; j < armors.size(); j++)
+				{
+					if ((best_mask >> j) & 1)
+					{
+						indices.push_back(j);
+					}
+				}
+				return indices;
+			};
+			
+			auto check = [&](const ArmorVector &armors, const ArmorSelection &selection, const std::vector<size_t> &expected)
+			{
+				TEST_EQUAL("same indices as the original", expected, selection.indices);
+				
+				int cost;
+				double defense;
+				sum_armor_vector(*materialize_selection(armors, selection), cost, defense);
+				TEST_EQUAL("same cost", cost, selection.total_cost);
+				TEST_EQUAL("same defense", std::round(defense * 100), std::round(selection.total_defense * 100));
+			};
+			
+			check(*filtered_armors, dynamic_max_defense_selection(*filtered_armors, 500), reference_dynamic_indices(*filtered_armors, 500));
+			check(*small_armors, dynamic_max_defense_selection(*small_armors, 200), reference_dynamic_indices(*small_armors, 200));
+			check(*small_armors, exhaustive_max_defense_selection(*small_armors, 200), baseline_exhaustive(*small_armors, 200));
+			
+			ArmorSelection empty = dynamic_max_defense_selection(trivial_armors, 3);
+			TEST_TRUE("empty selection", empty.indices.empty());
+			TEST_EQUAL("empty selection", 0, empty.total_cost);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"ArmorCatalog updates agree with a full re-solve", 2,
+		[&]()
+		{
+			auto small_armors = filter_armor_vector(*filtered_armors, 1, 2500, 60);
+			ArmorCatalog catalog(*small_armors, 200);
+			TEST_EQUAL("size", small_armors->size(), catalog.size());
+			
+			auto check = [&](int total_cost)
+			{
+				auto armors = catalog.armors();
+				ArmorSelection expected = dynamic_max_defense_selection(*armors, total_cost);
+				TEST_EQUAL("same optimum", std::round(expected.total_defense * 100), std::round(catalog.optimum_defense(total_cost) * 100));
+			};
+			check(200);
+			check(57);
+			
+			size_t id = catalog.add(std::shared_ptr<ArmorItem>(new ArmorItem("cheap shield", 3, 90.0)));
+			TEST_TRUE("add is incremental", catalog.last_update() == UpdatePath::Incremental);
+			TEST_EQUAL("rebuilds", 0, catalog.rebuilds());
+			check(200);
+			
+			ArmorSelection greedy = catalog.greedy_selection(200);
+			TEST_EQUAL("greedy takes best ratio first", id, greedy.indices.at(0));
+			
+			TEST_TRUE("remove", catalog.remove(id));
+			TEST_TRUE("remove rebuilds", catalog.last_update() == UpdatePath::Rebuild);
+			TEST_FALSE("remove twice", catalog.remove(id));
+			check(200);
+			
+			catalog.add(std::shared_ptr<ArmorItem>(new ArmorItem("golden helmet", 5000, 9000.0)));
+			TEST_TRUE("remove", catalog.remove(catalog.ids().back()));
+			TEST_TRUE("item above capacity is incremental", catalog.last_update() == UpdatePath::Incremental);
+			
+			check(400);
+			TEST_TRUE("growing capacity rebuilds", catalog.last_update() == UpdatePath::Rebuild);
+			TEST_EQUAL("capacity", 400, catalog.capacity());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"dynamic_max_defense matches the full-table reference", 2,
+		[&]()
+		{
+			auto some_armors = filter_armor_vector(*filtered_armors, 1, 2500, 300);
+			for (int total_cost : {0, 1, 37, 100, 499, 1000})
+			{
+				ArmorSelection selection = dynamic_max_defense_selection(*some_armors, total_cost);
+				TEST_EQUAL("same items", reference_dynamic_indices(*some_armors, total_cost), selection.indices);
+			}
+			TEST_EQUAL("boots only", reference_dynamic_indices(trivial_armors, 9), dynamic_max_defense_selection(trivial_armors, 9).indices);
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Hirschberg mode finds an optimal selection", 2,
+		[&]()
+		{
+			auto some_armors = filter_armor_vector(*filtered_armors, 1, 2500, 300);
+			for (int total_cost : {0, 1, 37, 100, 499, 1000})
+			{
+				ArmorSelection expected = dynamic_max_defense_selection(*some_armors, total_cost);
+				for (size_t base_bits : {size_t(0), size_t(4096), size_t(1) << 16})
+				{
+					ArmorSelection actual = dynamic_max_defense_hirschberg_selection(*some_armors, total_cost, base_bits);
+					TEST_LE("within budget", actual.total_cost, total_cost);
+					TEST_EQUAL("same defense", std::round(expected.total_defense * 100), std::round(actual.total_defense * 100));
+					TEST_TRUE("last to first", std::is_sorted(actual.indices.rbegin(), actual.indices.rend()));
+				}
+			}
+			
+			auto soln = dynamic_max_defense(trivial_armors, 9, DynamicMode::Hirschberg);
+			TEST_EQUAL("boots only", 1, soln->size());
+			TEST_EQUAL("boots only", "test boots", (*soln)[0]->description());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"Table2D rows are aligned and padded", 2,
+		[&]()
+		{
+			Table2D<double> table(3, 5, false, 1.5);
+			TEST_EQUAL("rows", 3, table.rows());
+			TEST_EQUAL("columns", 5, table.columns());
+			TEST_EQUAL("stride is one cache line", 8, table.stride());
+			TEST_EQUAL("fill", 1.5, table(2, 4));
+			table(1, 3) = 7;
+			TEST_EQUAL("row pointer", 7, table.row(1)[3]);
+			for (size_t i = 0; i < table.rows(); i++)
+			{
+				TEST_EQUAL("aligned row", 0, reinterpret_cast<uintptr_t>(table.row(i)) % 64);
+			}
+			
+			Table2D<uint64_t> huge(4, 100, true);
+			TEST_EQUAL("huge page aligned", 0, reinterpret_cast<uintptr_t>(huge.row(0)) % (2 << 20));
+			TEST_EQUAL("zeroed", 0, huge(3, 99));
+			
+			// 24-byte elements do not divide a line; rows are still aligned.
+			struct Triple { double a, b, c; };
+			Table2D<Triple> triples(3, 5);
+			TEST_EQUAL("stride fills whole lines", 8, triples.stride());
+			for (size_t i = 0; i < triples.rows(); i++)
+			{
+				TEST_EQUAL("aligned row", 0, reinterpret_cast<uintptr_t>(triples.row(i)) % 64);
+			}
+			
+			Table2D<double> empty(0, 0);
+			TEST_EQUAL("empty", 0, empty.rows());
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"vectorized DP row kernels are bit-exact", 2,
+		[&]()
+		{
+			std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+			if (simd_level_supported() != SimdLevel::Scalar)
+			{
+				levels.push_back(SimdLevel::AVX2);
+			}
+			if (simd_level_supported() == SimdLevel::AVX512)
+			{
+				levels.push_back(SimdLevel::AVX512);
+			}
+			
+			for (size_t width : {1, 3, 8, 67, 200})
+			{
+				for (size_t cost : {0, 1, 2, 5, 8, 64, 300})
+				{
+					std::vector<double> seed(width);
+					for (size_t j = 0; j < width; j++)
+					{
+						seed[j] = (j * 37 % 11) * 1.1 + j * 0.5;
+					}
+					
+					std::vector<double> expected = seed;
+					std::vector<uint64_t> expected_bits(4, 0);
+					dynamic_row_update(expected.data(), width, cost, 2.3, expected_bits.data(), SimdLevel::Scalar);
+					for (SimdLevel level : levels)
+					{
+						std::vector<double> actual = seed;
+						std::vector<uint64_t> actual_bits(4, 0);
+						dynamic_row_update(actual.data(), width, cost, 2.3, actual_bits.data(), level);
+						TEST_EQUAL("same row", expected, actual);
+						TEST_EQUAL("same bits", expected_bits, actual_bits);
+					}
+				}
+			}
+			
+			auto some_armors = filter_armor_vector(*filtered_armors, 1, 2500, 300);
+			for (SimdLevel level : levels)
+			{
+				ArmorSelection actual = dynamic_max_defense_selection(*some_armors, 777, level);
+				TEST_EQUAL("same items", reference_dynamic_indices(*some_armors, 777), actual.indices);
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"parallel DP gives the same selection", 2,
+		[&]()
+		{
+			auto some_armors = filter_armor_vector(*filtered_armors, 1, 2500, 300);
+			for (int total_cost : {0, 63, 64, 777, 2000})
+			{
+				auto expected = reference_dynamic_indices(*some_armors, total_cost);
+				for (unsigned threads : {1, 2, 3, 5})
+				{
+					ArmorSelection actual = dynamic_max_defense_parallel_selection(*some_armors, total_cost, threads);
+					TEST_EQUAL("same items", expected, actual.indices);
+				}
+			}
+		}
+	);
+	
+	//
+	rubric.criterion(
+		"cost compression shrinks the table, not the answer", 2,
+		[&]()
+		{
+			auto some_armors = filter_armor_vector(*filtered_armors, 1, 2500, 40);
+			ArmorVector priced_by_5;
+			int cost_sum = 0;
+			for (auto &armor : *some_armors)
+			{
+				priced_by_5.push_back(std::shared_ptr<ArmorItem>(new ArmorItem(armor->description(), armor->cost() * 5, armor->defense())));
+				cost_sum += armor->cost() * 5;
+			}
+			
+			for (int total_cost : {0, 4, 102, 1003, cost_sum - 1, cost_sum + 500})
+			{
+				CompressionStats stats;
+				auto expected = reference_dynamic_indices(priced_by_5, total_cost);
+				ArmorSelection actual = dynamic_max_defense_selection(priced_by_5, total_cost, simd_level_supported(), &stats);
+				TEST_EQUAL("same items", expected, actual.indices);
+				TEST_EQUAL("same items in parallel", expected, dynamic_max_defense_parallel_selection(priced_by_5, total_cost, 2).indices);
+				CompressionStats hirschberg_stats;
+				ArmorSelection hirschberg = dynamic_max_defense_hirschberg_selection(priced_by_5, total_cost, 4096, &hirschberg_stats);
+				TEST_EQUAL("Hirschberg defense", std::round(actual.total_defense * 100), std::round(hirschberg.total_defense * 100));
+				TEST_EQUAL("Hirschberg compressed width", stats.compressed_width, hirschberg_stats.compressed_width);
+				TEST_EQUAL("original width", size_t(total_cost + 1), stats.original_width);
+				if (stats.items_dropped < priced_by_5.size())
+				{
+					TEST_EQUAL("gcd", 5, stats.gcd);
+					TEST_GE("reduction", stats.reduction, 5.0 * (total_cost + 1) / (total_cost + 5));
+				}
+			}
+			
+			CompressionStats stats;
+			dynamic_max_defense_selection(priced_by_5, 10 * cost_sum, simd_level_supported(), &stats);
+			TEST_EQUAL("capped at the sum of costs", size_t(cost_sum / 5 + 1), stats.compressed_width);
+			
+			dynamic_max_defense_selection(trivial_armors, 9, simd_level_supported(), &stats);
+			TEST_EQUAL("helmet dropped", 1, stats.items_dropped);
+			TEST_EQUAL("gcd of the boots", 4, stats.gcd);
+			TEST_EQUAL("compressed width", 2, stats.compressed_width);
+		}
+	);
 	
 	return rubric.run();
 }
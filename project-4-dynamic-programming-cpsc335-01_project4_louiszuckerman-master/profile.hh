@@ -0,0 +1,232 @@
+///////////////////////////////////////////////////////////////////////////////
+// profile.hh
+//
+// Hierarchical scoped profiling built on Timer.
+//
+// Each PROFILE_SCOPE opens a region that is timed until the end of the
+// enclosing block. Regions opened inside other regions nest under them, and
+// each region records its call count and its min, mean, max and total
+// time. Every thread accumulates into its own tree without locking; the
+// trees are merged when threads exit, and the merged report is printed to
+// std::cerr when the program exits.
+//
+// Profiling is compiled in only when MAXDEFENSE_PROFILE is defined (for
+// example with make profile). Otherwise PROFILE_SCOPE expands to nothing
+// and costs nothing.
+//
+// How to use:
+//
+//    void load() {
+//      PROFILE_SCOPE("load");
+//      for (...) {
+//        PROFILE_SCOPE("parse row");   // reported as load/parse row
+//        ...
+//      }
+//    }
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "timer.hh"
+
+// Timing totals for one region of the profile tree.
+struct ProfileNode {
+  const char* name = "";
+  ProfileNode* parent = nullptr;
+  std::vector<std::unique_ptr<ProfileNode>> children;
+
+  size_t calls = 0;
+  double total = 0;
+  double min = std::numeric_limits<double>::infinity();
+  double max = 0;
+
+  // Return the child region called name, creating it if needed. Names are
+  // usually string literals, so the pointer is compared before the text.
+  ProfileNode* child(const char* child_name) {
+    for (auto& c : children) {
+      if (c->name == child_name || std::strcmp(c->name, child_name) == 0) {
+        return c.get();
+      }
+    }
+    children.emplace_back(new ProfileNode);
+    children.back()->name = child_name;
+    children.back()->parent = this;
+    return children.back().get();
+  }
+
+  void record(double seconds) {
+    calls++;
+    total += seconds;
+    min = std::min(min, seconds);
+    max = std::max(max, seconds);
+  }
+
+  // Add the totals of other and its subtree into this node.
+  void merge(const ProfileNode& other) {
+    calls += other.calls;
+    total += other.total;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    for (auto& c : other.children) {
+      child(c->name)->merge(*c);
+    }
+  }
+};
+
+// One flattened region of a profile report.
+struct ProfileEntry {
+  std::string path;
+  size_t calls;
+  double total, min, mean, max;
+};
+
+// The process-wide profile: thread trees are merged into it on thread exit.
+class ProfileRegistry {
+public:
+  static ProfileRegistry& instance() {
+    static ProfileRegistry registry;
+    return registry;
+  }
+
+  void merge(const ProfileNode& tree) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _root.merge(tree);
+  }
+
+  // Merged regions in depth-first order, with "/"-separated paths.
+  std::vector<ProfileEntry> entries() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::vector<ProfileEntry> result;
+    flatten(_root, "", result);
+    return result;
+  }
+
+  void report(std::ostream& out) {
+    auto all = entries();
+    if (all.empty()) {
+      return;
+    }
+    out << "*** Profile ***" << std::endl
+        << std::setw(40) << std::left << "region" << std::right
+        << std::setw(10) << "calls"
+        << std::setw(14) << "total s"
+        << std::setw(14) << "min s"
+        << std::setw(14) << "mean s"
+        << std::setw(14) << "max s" << std::endl;
+    for (auto& e : all) {
+      out << std::setw(40) << std::left << e.path << std::right
+          << std::setw(10) << e.calls
+          << std::setw(14) << e.total
+          << std::setw(14) << e.min
+          << std::setw(14) << e.mean
+          << std::setw(14) << e.max << std::endl;
+    }
+  }
+
+  // Forget everything merged so far.
+  void clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _root.children.clear();
+  }
+
+private:
+  ProfileRegistry() { }
+
+  ~ProfileRegistry() {
+#ifdef MAXDEFENSE_PROFILE
+    report(std::cerr);
+#endif
+  }
+
+  static void flatten(const ProfileNode& node, const std::string& prefix, std::vector<ProfileEntry>& out) {
+    for (auto& c : node.children) {
+      std::string path = prefix.empty() ? c->name : prefix + "/" + c->name;
+      out.push_back(ProfileEntry{path, c->calls, c->total, c->min, c->calls ? c->total / c->calls : 0, c->max});
+      flatten(*c, path, out);
+    }
+  }
+
+  std::mutex _mutex;
+  ProfileNode _root;
+};
+
+// The profile tree of the calling thread, merged into the registry when the
+// thread exits, or earlier with flush().
+class ThreadProfile {
+public:
+  static ThreadProfile& current() {
+    // Make sure the registry outlives every thread's profile.
+    ProfileRegistry::instance();
+    thread_local ThreadProfile profile;
+    return profile;
+  }
+
+  ProfileNode* enter(const char* name) {
+    _current = _current->child(name);
+    return _current;
+  }
+
+  void leave(ProfileNode* node, double seconds) {
+    node->record(seconds);
+    _current = node->parent;
+  }
+
+  // Merge what this thread has recorded so far into the registry, and
+  // start over. Must not be called inside an open region.
+  void flush() {
+    if (_current == &_root) {
+      ProfileRegistry::instance().merge(_root);
+      _root.children.clear();
+    }
+  }
+
+  ~ThreadProfile() {
+    flush();
+  }
+
+private:
+  ThreadProfile() : _current(&_root) { }
+
+  ProfileNode _root;
+  ProfileNode* _current;
+};
+
+// Times one region of the profile for as long as it is alive.
+class ProfileScope {
+public:
+  explicit ProfileScope(const char* name)
+    : _profile(ThreadProfile::current()),
+      _node(_profile.enter(name)) { }
+
+  ~ProfileScope() {
+    _profile.leave(_node, _timer.elapsed());
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+  ThreadProfile& _profile;
+  ProfileNode* _node;
+  Timer _timer;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef MAXDEFENSE_PROFILE
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(_profile_scope_, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif